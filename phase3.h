@@ -23,6 +23,16 @@
  */
 #define P3_SWAP_DISK 1
 
+/*
+ * Page replacement policies, see P3_VmSetPolicy.
+ */
+#define P3_POLICY_CLOCK     0   /* second-chance clock (the default) */
+#define P3_POLICY_NRU       1   /* enhanced clock, prefers clean victims */
+#define P3_POLICY_WSCLOCK   2   /* working-set clock, see P3_VmSetWorkingSet */
+#define P3_POLICY_CLOCKPRO  3   /* scan-resistant, keeps re-referenced pages hot */
+#define P3_POLICY_AGING     4   /* evicts the page with the oldest sampled age */
+#define P3_NUM_POLICIES     5
+
 /*
  * Paging statistics
  */
@@ -37,6 +47,26 @@ typedef struct P3_VmStats {
     int pageIns;    /* # faults that required reading page from disk */
     int pageOuts;   /* # faults that required writing a page to disk */
     int replaced;   /* # pages replaced */
+    int steals;     /* # faults serviced by a pager other than their owner */
+    int coalesced;  /* # faults that waited on a page being read ahead */
+    int readAhead;  /* # pages read from disk ahead of a sequential fault */
+    int inlineFaults; /* # faults resolved by the faulting process without a pager */
+    int reclaimed;  /* # frames freed by the reclaimer ahead of a fault */
+    int preZeroed;  /* # new pages given a frame zeroed ahead of time */
+    int policy;     /* replacement policy in use (P3_POLICY_*) */
+    int scanned;    /* # frames the policy examined looking for victims */
+    int secondChances; /* # recently referenced frames the policy passed over */
+    int writebacks; /* # dirty pages written to swap in the background */
+    int outsideWorkingSet; /* # victims older than the working-set window */
+    int ghostHits;  /* # faults on recently evicted pages, which come back hot */
+    int agingScans; /* # reference-bit scans by the aging daemon */
+    int cleanEvictions; /* # swapped-in pages evicted without a write */
+    int zeroPages;  /* # dirty victims found all zero and not written */
+    int compressed; /* # victims put in the compressed store */
+    int decompressed; /* # faults served from the compressed store */
+    int spilled;    /* # pages moved from the compressed store to disk */
+    int merged;     /* # pages merged into another process's frame */
+    int cowFaults;  /* # writes to merged pages that were given a copy */
 } P3_VmStats;
 
 extern P3_VmStats P3_vmStats;
@@ -57,6 +87,8 @@ extern P3_VmStats P3_vmStats;
 #define P3_OUT_OF_PAGES             -39
 #define P3_INVALID_FRAME            -40
 #define P3_INVALID_PAGE             -41
+#define P3_INVALID_POLICY           -42
+#define P3_INVALID_ARGUMENT         -43
 
 #ifndef CHECKRETURN
 #define CHECKRETURN __attribute__((warn_unused_result))
@@ -64,6 +96,11 @@ extern P3_VmStats P3_vmStats;
 
 extern int          P3_VmInit(int mappings, int pages, int frames, int pagers) CHECKRETURN;
 extern void         P3_VmDestroy(void);
+extern int          P3_VmSetWatermarks(int low, int high) CHECKRETURN;
+extern int          P3_VmSetPolicy(int policy) CHECKRETURN;
+extern int          P3_VmSetWorkingSet(int window) CHECKRETURN;
+extern int          P3_VmSetCompression(int percent) CHECKRETURN;
+extern int          P3_VmSetMerging(int seconds) CHECKRETURN;
 extern  USLOSS_PTE  *P3_AllocatePageTable(int pid) CHECKRETURN;
 extern  void        P3_FreePageTable(int pid);
 extern void         P3_PrintStats(P3_VmStats *stats);
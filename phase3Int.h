@@ -28,6 +28,10 @@ typedef int PID;    // PID
 
 int         P3PageTableGet(PID pid, USLOSS_PTE **table) CHECKRETURN;
 int         P3PageTableSet(PID pid, USLOSS_PTE *table) CHECKRETURN;
+int         P3WatermarksGet(int *low, int *high) CHECKRETURN;
+int         P3WorkingSetGet(int *window) CHECKRETURN;
+int         P3CompressionGet(int *frames) CHECKRETURN;
+int         P3MergingGet(int *seconds) CHECKRETURN;
 
 
 // Phase 3b
@@ -37,21 +41,41 @@ USLOSS_PTE *P3PageTableAllocateEmpty(int numPages) CHECKRETURN;
 
 // Phase 3c
 
+// Frame states in the reverse map kept by Phase 3c.
+#define P3_FRAME_FREE       0   // on the free list
+#define P3_FRAME_BUSY       1   // allocated, being filled or evicted
+#define P3_FRAME_MAPPED     2   // holds a page and is mapped by its process
+#define P3_FRAME_SHARED     3   // holds a merged page, mapped read-only by several
+
 int         P3FrameInit(int pages, int frames) CHECKRETURN;
 int         P3FrameShutdown(void) CHECKRETURN;
 int         P3FrameFreeAll(PID pid) CHECKRETURN;
 int         P3FrameMap(int frame, void **addr) CHECKRETURN;
 int         P3FrameUnmap(int frame) CHECKRETURN;
+int         P3FrameInfo(int frame, PID *pid, int *page, int *state) CHECKRETURN;
+int         P3FrameEvict(int frame, PID *pid, int *page) CHECKRETURN;
+int         P3FrameKeep(int frame) CHECKRETURN;
+int         P3FrameWindowCreate(void) CHECKRETURN;
+int         P3FrameWindowDestroy(void) CHECKRETURN;
 
 int         P3PagerInit(int pages, int frames, int pagers) CHECKRETURN;
 int         P3PagerShutdown(void)  CHECKRETURN;
 
 // Phase 3d
 
+// Most pages P3SwapInCluster will read, or P3SwapOutBatch replace, at once.
+#define P3_MAX_CLUSTER 8
+
 int         P3SwapInit(int pages, int frames) CHECKRETURN;
 int         P3SwapShutdown(void) CHECKRETURN;
 int         P3SwapFreeAll(PID pid) CHECKRETURN;
 int         P3SwapOut(int *frame) CHECKRETURN;
+int         P3SwapOutBatch(int max, int *frames, int *count) CHECKRETURN;
 int         P3SwapIn(PID pid, int page, int frame) CHECKRETURN;
+int         P3SwapInCluster(PID pid, int count, int *pages, int *frames, int *results) CHECKRETURN;
+int         P3SwapQuery(PID pid, int page) CHECKRETURN;
+int         P3SwapNotify(PID pid, int page, int frame) CHECKRETURN;
+int         P3SwapWake(void) CHECKRETURN;
+int         P3SwapForget(int frame) CHECKRETURN;
 
 #endif
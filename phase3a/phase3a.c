@@ -23,6 +23,30 @@ static USLOSS_PTE  *PageTableAllocateIdentity(int pages);
 
 static int initialized = FALSE;
 
+// Free-frame watermarks for the reclaimer. The requested values are set by
+// P3_VmSetWatermarks (-1 for the default) and resolved by P3_VmInit; the
+// reclaimer is off until P3_VmSetWatermarks turns it on.
+static int requestedLow = 0;
+static int requestedHigh = 0;
+static int lowWater = 0;
+static int highWater = 0;
+
+// Replacement policy used by the next P3_VmInit.
+static int policy = P3_POLICY_CLOCK;
+
+// Working-set window for P3_POLICY_WSCLOCK, in microseconds of the owning
+// process's CPU time.
+#define DEFAULT_WORKING_SET 20000
+static int workingSet = DEFAULT_WORKING_SET;
+
+// Share of the frames' worth of memory given to Phase 3d's compressed page
+// store, in percent; 0 disables the store.
+static int compression = 0;
+
+// Seconds between the passes of Phase 3c's page merging daemon; 0 disables
+// merging.
+static int merging = 0;
+
 static int          MMUInit(int pages, int frames);
 static int          MMUShutdown(void);
 static int          PageTableFree(PID pid);
@@ -34,7 +58,10 @@ static int          PageTableFree(PID pid);
  * P3_VmInit --
  *
  *	Initializes the VM system by configuring the MMU and setting
- *	up the page tables.
+ *	up the page tables. The reclaimer watermarks requested with
+ *	P3_VmSetWatermarks are resolved against the number of frames,
+ *	and the policy chosen with P3_VmSetPolicy is recorded in
+ *	P3_vmStats for Phase 3d.
  *
  * Parameters:
  *      mappings: unused
@@ -66,7 +93,23 @@ P3_VmInit(int unused, int pages, int frames, int pagers)
         goto done;
     }
 
+    // by default reclaim when fewer than a quarter of the frames are free,
+    // until half of them are. A watermark can't exceed the number of frames
+    // the reclaimer could ever free, so clamp them to frames - 1.
+    lowWater = requestedLow == -1 ? frames / 4 : requestedLow;
+    highWater = requestedHigh == -1 ? frames / 2 : requestedHigh;
+    if (highWater < lowWater) {
+        highWater = lowWater;
+    }
+    if (highWater >= frames) {
+        highWater = frames > 0 ? frames - 1 : 0;
+    }
+    if (lowWater > highWater) {
+        lowWater = highWater;
+    }
+
     memset((char *) &P3_vmStats, 0, sizeof(P3_vmStats));
+    P3_vmStats.policy = policy;
 
     for (int i = 0; i < P1_MAXPROC; i++) {
         pageTables[i] = NULL;
@@ -108,6 +151,139 @@ P3_VmInit(int unused, int pages, int frames, int pagers)
 done:
     return result;
 }
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3_VmSetWatermarks --
+ *
+ *	Sets the free-frame watermarks used by the next P3_VmInit. The
+ *	reclaimer starts evicting pages when fewer than low frames are
+ *	free and stops once high frames are free. A low watermark of 0
+ *	disables the reclaimer, which is the default; -1 selects a
+ *	quarter of the frames for low and half of them for high. P3_VmInit
+ *	clamps both watermarks to one less than the number of frames.
+ *
+ * Results:
+ *      P3_INVALID_ARGUMENT:    a watermark is less than -1, or high
+ *                              is less than low
+ *      P1_SUCCESS:             success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3_VmSetWatermarks(int low, int high)
+{
+    if ((low < -1) || (high < -1) || ((low >= 0) && (high >= 0) && (high < low))) {
+        return P3_INVALID_ARGUMENT;
+    }
+    requestedLow = low;
+    requestedHigh = high;
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3_VmSetPolicy --
+ *
+ *	Selects the page replacement policy used by the next P3_VmInit.
+ *
+ * Results:
+ *      P3_INVALID_POLICY:      policy is not one of P3_POLICY_*
+ *      P1_SUCCESS:             success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3_VmSetPolicy(int newPolicy)
+{
+    if ((newPolicy < 0) || (newPolicy >= P3_NUM_POLICIES)) {
+        return P3_INVALID_POLICY;
+    }
+    policy = newPolicy;
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3_VmSetWorkingSet --
+ *
+ *	Sets the working-set window used by P3_POLICY_WSCLOCK from the
+ *	next P3_VmInit on. A page that its process has not referenced
+ *	for window microseconds of that process's CPU time is outside
+ *	its working set and may be replaced; -1 selects the default.
+ *
+ * Results:
+ *      P3_INVALID_ARGUMENT:    window is less than -1
+ *      P1_SUCCESS:             success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3_VmSetWorkingSet(int window)
+{
+    if (window < -1) {
+        return P3_INVALID_ARGUMENT;
+    }
+    workingSet = (window == -1) ? DEFAULT_WORKING_SET : window;
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3_VmSetCompression --
+ *
+ *	Sets the size of the compressed page store used from the next
+ *	P3_VmInit on, as a percentage of the frames. Evicted pages are
+ *	compressed into the store before they go to the swap disk, and
+ *	the oldest ones are moved to disk as it fills up. 0 disables
+ *	the store.
+ *
+ * Results:
+ *      P3_INVALID_ARGUMENT:    percent is not between 0 and 100
+ *      P1_SUCCESS:             success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3_VmSetCompression(int percent)
+{
+    if (percent < 0 || percent > 100) {
+        return P3_INVALID_ARGUMENT;
+    }
+    compression = percent;
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3_VmSetMerging --
+ *
+ *	Turns on page merging from the next P3_VmInit on. Every seconds
+ *	seconds a daemon looks for pages of different processes with
+ *	the same contents and maps them to one read-only frame; a
+ *	process that writes to such a page gets a copy of its own. 0
+ *	turns merging off.
+ *
+ * Results:
+ *      P3_INVALID_ARGUMENT:    seconds is negative
+ *      P1_SUCCESS:             success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3_VmSetMerging(int seconds)
+{
+    if (seconds < 0) {
+        return P3_INVALID_ARGUMENT;
+    }
+    merging = seconds;
+    return P1_SUCCESS;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -245,6 +421,7 @@ P3_FreePageTable(int pid)
             USLOSS_Console("P3_FreePageTable: PageTableFree(%d) failed: %d\n", pid, rc);
             goto done;
         }
+        pageTables[pid] = NULL;
     }
 done:
     return;
@@ -262,6 +439,47 @@ P3PageTableGet(PID pid, USLOSS_PTE **table)
     return result;
 }
 
+int
+P3WatermarksGet(int *low, int *high)
+{
+    if (!initialized) {
+        return P3_NOT_INITIALIZED;
+    }
+    *low = lowWater;
+    *high = highWater;
+    return P1_SUCCESS;
+}
+
+int
+P3WorkingSetGet(int *window)
+{
+    if (!initialized) {
+        return P3_NOT_INITIALIZED;
+    }
+    *window = workingSet;
+    return P1_SUCCESS;
+}
+
+int
+P3CompressionGet(int *frames)
+{
+    if (!initialized) {
+        return P3_NOT_INITIALIZED;
+    }
+    *frames = numFrames * compression / 100;
+    return P1_SUCCESS;
+}
+
+int
+P3MergingGet(int *seconds)
+{
+    if (!initialized) {
+        return P3_NOT_INITIALIZED;
+    }
+    *seconds = merging;
+    return P1_SUCCESS;
+}
+
 int
 P3PageTableSet(PID pid, USLOSS_PTE *table)
 {
@@ -373,5 +591,25 @@ P3_PrintStats(P3_VmStats *stats)
     USLOSS_Console("\tpageIns:\t%d\n", stats->pageIns);
     USLOSS_Console("\tpageOuts:\t%d\n", stats->pageOuts);
     USLOSS_Console("\treplaced:\t%d\n", stats->replaced);
+    USLOSS_Console("\tsteals:\t\t%d\n", stats->steals);
+    USLOSS_Console("\tcoalesced:\t%d\n", stats->coalesced);
+    USLOSS_Console("\treadAhead:\t%d\n", stats->readAhead);
+    USLOSS_Console("\tinlineFaults:\t%d\n", stats->inlineFaults);
+    USLOSS_Console("\treclaimed:\t%d\n", stats->reclaimed);
+    USLOSS_Console("\tpreZeroed:\t%d\n", stats->preZeroed);
+    USLOSS_Console("\tpolicy:\t\t%d\n", stats->policy);
+    USLOSS_Console("\tscanned:\t%d\n", stats->scanned);
+    USLOSS_Console("\tsecondChances:\t%d\n", stats->secondChances);
+    USLOSS_Console("\twritebacks:\t%d\n", stats->writebacks);
+    USLOSS_Console("\toutsideWorkingSet:\t%d\n", stats->outsideWorkingSet);
+    USLOSS_Console("\tghostHits:\t%d\n", stats->ghostHits);
+    USLOSS_Console("\tagingScans:\t%d\n", stats->agingScans);
+    USLOSS_Console("\tcleanEvictions:\t%d\n", stats->cleanEvictions);
+    USLOSS_Console("\tzeroPages:\t%d\n", stats->zeroPages);
+    USLOSS_Console("\tcompressed:\t%d\n", stats->compressed);
+    USLOSS_Console("\tdecompressed:\t%d\n", stats->decompressed);
+    USLOSS_Console("\tspilled:\t%d\n", stats->spilled);
+    USLOSS_Console("\tmerged:\t\t%d\n", stats->merged);
+    USLOSS_Console("\tcowFaults:\t%d\n", stats->cowFaults);
 }
 
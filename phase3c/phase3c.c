@@ -14,6 +14,7 @@
 #include <phase2.h>
 #include <usloss.h>
 #include <string.h>
+#include <stdlib.h>
 #include <libuser.h>
 
 #include "phase3.h"
@@ -35,33 +36,79 @@ void debug3(char *fmt, ...)
     }
 }
 
-static int FRAME_UNUSED = 1;
-static int FRAME_MAPPED = 2;
+// Identical pages of different processes are merged by the merger daemon
+// into one P3_FRAME_SHARED frame that they all map read-only; the first
+// write to one of them faults and gives the writer a copy of its own
+// (FaultCopyOnWrite, or a pager's CopyService if no frame is free). A
+// shared frame's first user is its owner in the reverse map and the others
+// are on its sharers list. Shared frames are never evicted, so the merger
+// keeps them to half of the frames.
+typedef struct Sharer {
+    PID pid;
+    int page;
+    struct Sharer *next;
+} Sharer;
 
+// The reverse map: which page of which process each frame holds. Phase 3d
+// reads it through P3FrameInfo and P3FrameEvict instead of keeping its own.
 typedef struct Frame
 {
-    PID pid;
-    int state;
+    PID pid;        // owning process, -1 if free
+    int page;       // page of the owner held in the frame, -1 if none yet
+    int state;      // P3_FRAME_*
+    int mapPage;    // page P3FrameMap used to map the frame, -1 if not mapped
+    USLOSS_PTE *mapTable; // page table holding that mapping
+    Sharer *sharers;    // the other users of a shared frame
 } Frame;
 
 static Frame *framesList;
 static SID frameSem;
+
+// Free frames are kept on stacks threaded through frameNext so that
+// allocating and freeing a frame is constant time. Freed frames go on the
+// free stack; the zeroing daemon moves them to the zero stack once they
+// have been filled with zeros. Protected by frameSem.
+static int *frameNext;
+static int freeFrameHead = -1;
+static int zeroFrameHead = -1;
+static int mappedFrames;    // # of frames in P3_FRAME_MAPPED
 static SID vmStatsSem;
 
-typedef struct PagerStruct {
-    PID pid;
-    SID sid;
-    int quit;
-} PagerStruct;
+// Kernel processes that touch frame contents (the pagers and the daemons)
+// map frames through a window of slots in their own page table, so P3FrameMap
+// never has to search a user's page table for a free page. A window is only
+// used by its owner.
+#define WINDOW_SLOTS P3_MAX_CLUSTER
 
-static int Pager(void *arg);
-static PagerStruct pagersList[P3_MAX_PAGERS];
-static int initialized;
-static int numPages;
+typedef struct Window {
+    USLOSS_PTE *table;  // the process's page table, NULL if it has no window
+    int allocated;      // table was allocated by WindowCreate
+    int slots;          // # of pages at the start of the region in the window
+    int used;           // bitmask of slots in use
+} Window;
+
+static Window windows[P1_MAXPROC];
 
+// A process that writes to a merged page has no window; it copies the page
+// through this table instead, with interrupts off while it is loaded.
+static USLOSS_PTE *copyTable;
 
 // information about a fault. Add to this as necessary.
 
+// A fault is owned by the queue it sits on until a pager dequeues it, then
+// by that pager until it is completed. Faults complete in any order; the
+// faulting process waits on its own record and releases it when woken.
+#define FAULT_FREE      0
+#define FAULT_QUEUED    1
+#define FAULT_INFLIGHT  2
+#define FAULT_DONE      3
+#define FAULT_ATTACHED  4   // duplicate waiting on another fault for the same page
+
+// What FaultCopyOnWrite did with an access fault.
+#define COW_RETRY   0   // the write can be retried
+#define COW_PAGER   1   // there is no free frame, a pager has to make the copy
+#define COW_DENIED  2   // the page isn't merged, it is a real access violation
+
 typedef struct Fault {
     PID         pid;
     int         offset;
@@ -70,14 +117,108 @@ typedef struct Fault {
     // other stuff goes here
     struct Fault*       next; //The next fault in the linked list
     int         status;
+    int         state;  // FAULT_*
+    int         pager;  // index of the pager servicing the fault, or -1
+    int         page;   // faulting page
+    struct Fault*       hashNext;   // next fault in the same in-flight bucket
+    struct Fault*       dups;       // duplicate faults attached to this one
 } Fault;
 
-static Fault *faultHead;
-static Fault *faultTail;
-static SID    faultSem;
-static SID    faultListSem;
+// Each pager owns a queue of pending faults. Faults are routed to a queue
+// by PID; a pager whose queue is empty steals from the longest queue.
+typedef struct PagerStruct {
+    PID pid;
+    SID sid;        // wakes the pager, one V per fault routed to its queue
+    int quit;
+    int idle;       // pager is blocked on sid waiting for work
+    SID mutex;      // protects the queue below
+    Fault *faultHead;
+    Fault *faultTail;
+    int count;      // # of faults in the queue
+    Fault *inflight; // fault this pager is currently servicing
+} PagerStruct;
+
+static int Pager(void *arg);
+static PagerStruct pagersList[P3_MAX_PAGERS];
+static SID pagersDone;  // V'd by each pager when it exits
+static int initialized;
+static int numPages;
+
+static SID    faultPoolSem;     // protects faultPool and inflightTable
 static int numPagers;
 
+// Sequential fault detection. When a process faults READAHEAD_RUN times in
+// a row with the same small stride, the pager brings in the next
+// READAHEAD_PAGES pages along that stride that are on the swap disk, after
+// it has let the process run again.
+#define READAHEAD_RUN   2
+#define READAHEAD_PAGES 4
+#define READAHEAD_STRIDE 2  // largest stride (in pages) treated as sequential
+
+typedef struct SeqInfo {
+    int lastPage;   // last page faulted on (or read ahead)
+    int stride;     // distance between the last two faults
+    int run;        // # of consecutive faults with that stride
+    int gen;        // bumped by P3FrameFreeAll, so a read-ahead can tell
+                    // that its process quit; protected by frameSem
+} SeqInfo;
+
+static SeqInfo seqInfo[P1_MAXPROC];
+
+// Background daemons. The reclaimer evicts pages once fewer than lowWater
+// frames are free, until highWater are, so that a fault rarely has to wait
+// for P3SwapOut; a lowWater of 0 disables it. The zeroer runs when the CPU
+// is otherwise idle and zeroes the frames on the free stack so that a new
+// page can be given a frame without zeroing it on the fault path.
+typedef struct Daemon {
+    PID pid;
+    SID sid;        // wakes the daemon, -1 if it is not running
+    int quit;
+    int awake;      // woken and not back to sleep yet, protected by frameSem
+} Daemon;
+
+#define ZEROER_PRIORITY 5
+
+static Daemon reclaimer = {-1, -1, 0, FALSE};
+static Daemon zeroer = {-1, -1, 0, FALSE};
+static SID reclaimerDone;   // V'd by the reclaimer when it exits
+static SID zeroerDone;  // V'd by the zeroer when it exits
+static int lowWater;
+static int highWater;
+static int Reclaim(void *arg);
+static int Zero(void *arg);
+
+// The merger wakes every mergeInterval seconds (0 disables it) and merges
+// frames holding the same data. A frame it is comparing is busy and
+// write-protected; a process that writes to it waits on mergeWait until
+// the merger is done. sharedFrames, mergeWaiters are protected by frameSem.
+static Daemon merger = {-1, -1, 0, FALSE};
+static SID mergerDone;  // V'd by the merger when it exits
+static int mergeInterval;
+static int sharedFrames;    // # of shared frames, counting pinned ones
+static SID mergeWait;
+static int mergeWaiters;
+static int Merge(void *arg);
+
+// A process has at most one outstanding fault, so a pool of P1_MAXPROC
+// records (and one wait semaphore per PID) covers every possible fault.
+// Each pager also needs a record per page it reads ahead. Both are set up
+// once in P3PagerInit so the fault path never allocates.
+#define FAULT_POOL_SIZE (P1_MAXPROC + P3_MAX_PAGERS * READAHEAD_PAGES)
+static Fault  faultPool[FAULT_POOL_SIZE];
+static Fault *faultFree;
+static SID    faultWait[P1_MAXPROC];
+
+// Queued and in-flight faults hashed by (pid, page). A process blocks on
+// its fault, so two of its own faults never collide here; the table is for
+// the pages a pager reads ahead (ReadAhead) after the process's fault has
+// completed. A fault on a page that is being read ahead attaches to the
+// read-ahead record instead of being queued, and is woken when the read
+// completes.
+#define FAULT_HASH_SIZE P1_MAXPROC
+#define FaultHash(pid, page) ((((pid) * numPages) + (page)) % FAULT_HASH_SIZE)
+static Fault *inflightTable[FAULT_HASH_SIZE];
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // Helper Functions
@@ -93,6 +234,534 @@ static void checkInKernelMode() {
     }
 }
 
+// Takes a record from the fault pool. Caller must hold faultPoolSem.
+static Fault *FaultAlloc(void) {
+    Fault *fault = faultFree;
+    assert(fault != NULL);
+    faultFree = fault->next;
+    fault->next = NULL;
+    fault->status = P1_SUCCESS;
+    fault->state = FAULT_QUEUED;
+    fault->pager = -1;
+    fault->hashNext = NULL;
+    fault->dups = NULL;
+    return fault;
+}
+
+// Returns a record to the fault pool. Caller must hold faultPoolSem.
+static void FaultRelease(Fault *fault) {
+    fault->pid = -1;
+    fault->state = FAULT_FREE;
+    fault->next = faultFree;
+    faultFree = fault;
+}
+
+// Finds the queued or in-flight fault for (pid, page). Caller must hold
+// faultPoolSem.
+static Fault *InflightLookup(PID pid, int page) {
+    Fault *fault;
+    for (fault = inflightTable[FaultHash(pid, page)]; fault != NULL;
+         fault = fault->hashNext) {
+        if (fault->pid == pid && fault->page == page) {
+            break;
+        }
+    }
+    return fault;
+}
+
+// Adds a fault to the in-flight table. Caller must hold faultPoolSem.
+static void InflightInsert(Fault *fault) {
+    int bucket = FaultHash(fault->pid, fault->page);
+    fault->hashNext = inflightTable[bucket];
+    inflightTable[bucket] = fault;
+}
+
+// Removes a fault from the in-flight table. Caller must hold faultPoolSem.
+static void InflightRemove(Fault *fault) {
+    Fault **prev = &inflightTable[FaultHash(fault->pid, fault->page)];
+    while (*prev != fault) {
+        assert(*prev != NULL);
+        prev = &(*prev)->hashNext;
+    }
+    *prev = fault->hashNext;
+    fault->hashNext = NULL;
+}
+
+// Appends a fault to a pager's queue.
+static void FaultEnqueue(PagerStruct *pager, Fault *fault) {
+    assert(P1_P(pager->mutex) == P1_SUCCESS);
+    fault->next = NULL;
+    if (pager->faultHead == NULL) {
+        pager->faultHead = fault;
+    } else {
+        pager->faultTail->next = fault;
+    }
+    pager->faultTail = fault;
+    pager->count++;
+    assert(P1_V(pager->mutex) == P1_SUCCESS);
+}
+
+// Removes the oldest fault from a pager's queue, NULL if it is empty.
+static Fault *FaultDequeue(PagerStruct *pager) {
+    assert(P1_P(pager->mutex) == P1_SUCCESS);
+    Fault *fault = pager->faultHead;
+    if (fault != NULL) {
+        pager->faultHead = fault->next;
+        if (pager->faultHead == NULL) {
+            pager->faultTail = NULL;
+        }
+        pager->count--;
+        fault->next = NULL;
+    }
+    assert(P1_V(pager->mutex) == P1_SUCCESS);
+    return fault;
+}
+
+// Takes a fault from the longest queue other than the pager's own.
+static Fault *FaultSteal(PagerStruct *self) {
+    PagerStruct *victim = NULL;
+    int i;
+    for (i = 0; i < numPagers; i++) {
+        PagerStruct *pager = &pagersList[i];
+        if (pager != self && pager->count > 0 &&
+            (victim == NULL || pager->count > victim->count)) {
+            victim = pager;
+        }
+    }
+    Fault *fault = NULL;
+    if (victim != NULL) {
+        fault = FaultDequeue(victim);
+        if (fault != NULL) {
+            assert(P1_P(vmStatsSem) == P1_SUCCESS);
+            P3_vmStats.steals += 1;
+            assert(P1_V(vmStatsSem) == P1_SUCCESS);
+        }
+    }
+    return fault;
+}
+
+// Pushes a frame on the free stack. Caller must hold frameSem.
+static void FramePush(int frame) {
+    if (framesList[frame].state == P3_FRAME_MAPPED) {
+        mappedFrames--;
+    }
+    framesList[frame].state = P3_FRAME_FREE;
+    framesList[frame].pid = -1;
+    framesList[frame].page = -1;
+    frameNext[frame] = freeFrameHead;
+    freeFrameHead = frame;
+    assert(P1_P(vmStatsSem) == P1_SUCCESS);
+    P3_vmStats.freeFrames += 1;
+    assert(P1_V(vmStatsSem) == P1_SUCCESS);
+    if (zeroer.sid != -1 && !zeroer.awake) {
+        zeroer.awake = TRUE;
+        assert(P1_V(zeroer.sid) == P1_SUCCESS);
+    }
+}
+
+// Pops a frame off a free stack, -1 if it is empty. Caller must hold frameSem.
+static int FramePop(int *head) {
+    int frame = *head;
+    if (frame != -1) {
+        *head = frameNext[frame];
+        frameNext[frame] = -1;
+    }
+    return frame;
+}
+
+// Sets who a busy frame is being filled for.
+static void FrameAssign(int frame, PID pid, int page) {
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    assert(framesList[frame].state == P3_FRAME_BUSY);
+    framesList[frame].pid = pid;
+    framesList[frame].page = page;
+    assert(P1_V(frameSem) == P1_SUCCESS);
+}
+
+// Claims a free frame for page of pid, -1 if there is none. The frame is
+// busy until FrameInstall maps it. If zeroed is not NULL the caller wants a
+// zeroed frame and *zeroed is set if it got one; otherwise frames that
+// still need zeroing are handed out first.
+static int FrameClaim(PID pid, int page, int *zeroed) {
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    int frame;
+    if (zeroed != NULL) {
+        frame = FramePop(&zeroFrameHead);
+        *zeroed = (frame != -1);
+        if (frame == -1) {
+            frame = FramePop(&freeFrameHead);
+        }
+    } else {
+        frame = FramePop(&freeFrameHead);
+        if (frame == -1) {
+            frame = FramePop(&zeroFrameHead);
+        }
+    }
+    if (frame != -1) {
+        framesList[frame].pid = pid;
+        framesList[frame].page = page;
+        framesList[frame].state = P3_FRAME_BUSY;
+        assert(P1_P(vmStatsSem) == P1_SUCCESS);
+        P3_vmStats.freeFrames -= 1;
+        int wake = P3_vmStats.freeFrames < lowWater;
+        assert(P1_V(vmStatsSem) == P1_SUCCESS);
+        if (wake && reclaimer.sid != -1 && !reclaimer.awake) {
+            reclaimer.awake = TRUE;
+            assert(P1_V(reclaimer.sid) == P1_SUCCESS);
+        }
+    }
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    return frame;
+}
+
+// Returns a claimed frame that ended up not being used.
+static void FrameUnclaim(int frame) {
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    FramePush(frame);
+    assert(P1_V(frameSem) == P1_SUCCESS);
+}
+
+// Maps page of pid's page table to frame. Caller must hold frameSem.
+static void FrameMapPage(USLOSS_PTE *table, PID pid, int page, int frame) {
+    table[page].frame = frame;
+    table[page].incore = 1;
+    table[page].read = 1;
+    table[page].write = 1;
+    framesList[frame].pid = pid;
+    framesList[frame].page = page;
+    framesList[frame].state = P3_FRAME_MAPPED;
+    mappedFrames++;
+}
+
+// Maps page of pid's address space to frame and loads the page table. The
+// access bits are cleared first so that filling the frame doesn't count as
+// the process writing the page. Wakes the pagers waiting for a victim.
+static void FrameInstall(PID pid, int page, int frame) {
+    USLOSS_PTE *table;
+    int ret = P3PageTableGet(pid, &table);
+    assert(ret == P1_SUCCESS && table != NULL);
+    ret = USLOSS_MmuSetAccess(frame, 0);
+    assert(ret == USLOSS_MMU_OK);
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    FrameMapPage(table, pid, page, frame);
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    ret = USLOSS_MmuSetPageTable(table);
+    assert(ret == USLOSS_MMU_OK);
+    assert(P3SwapWake() == P1_SUCCESS);
+}
+
+// Like FrameInstall for a page that was read ahead, unless its process has
+// quit since gen was read from seqInfo, in which case the frame is freed.
+// Returns TRUE if the page was mapped.
+static int FrameInstallAhead(PID pid, int page, int frame, int gen) {
+    USLOSS_PTE *table;
+    assert(USLOSS_MmuSetAccess(frame, 0) == USLOSS_MMU_OK);
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    if (seqInfo[pid].gen != gen) {
+        FramePush(frame);
+        assert(P1_V(frameSem) == P1_SUCCESS);
+        // the swap code has already given the frame to the policy
+        assert(P3SwapForget(frame) == P1_SUCCESS);
+        return FALSE;
+    }
+    assert(P3PageTableGet(pid, &table) == P1_SUCCESS && table != NULL);
+    FrameMapPage(table, pid, page, frame);
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    assert(USLOSS_MmuSetPageTable(table) == USLOSS_MMU_OK);
+    assert(P3SwapWake() == P1_SUCCESS);
+    return TRUE;
+}
+
+// Tells whether page of pid is out of memory, and its process hasn't quit
+// since gen was read from seqInfo. Takes frameSem; may be called with
+// faultPoolSem held.
+static int PageMissing(PID pid, int page, int gen) {
+    USLOSS_PTE *table;
+    int missing = FALSE;
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    if (seqInfo[pid].gen == gen &&
+        P3PageTableGet(pid, &table) == P1_SUCCESS && table != NULL) {
+        missing = !table[page].incore;
+    }
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    return missing;
+}
+
+// Tells whether page of pid is mapped to frame. Caller must hold frameSem.
+static int FrameMaps(PID pid, int page, int frame) {
+    USLOSS_PTE *table;
+    if (pid == -1 || P3PageTableGet(pid, &table) != P1_SUCCESS || table == NULL) {
+        return FALSE;
+    }
+    return table[page].incore && table[page].frame == frame;
+}
+
+// Takes a mapped or shared frame away from the replacement policy and from
+// P3FrameFreeAll while the merger works on it, returning its state. Caller
+// must hold frameSem.
+static int FramePin(int frame) {
+    int state = framesList[frame].state;
+    assert(state == P3_FRAME_MAPPED || state == P3_FRAME_SHARED);
+    if (state == P3_FRAME_MAPPED) {
+        mappedFrames--;
+    }
+    framesList[frame].state = P3_FRAME_BUSY;
+    return state;
+}
+
+// Makes every page mapped to a frame read-only. Caller must hold frameSem.
+static void FrameProtect(int frame) {
+    Sharer owner = {framesList[frame].pid, framesList[frame].page,
+                    framesList[frame].sharers};
+    Sharer *user;
+    for (user = &owner; user != NULL; user = user->next) {
+        USLOSS_PTE *table;
+        if (FrameMaps(user->pid, user->page, frame)) {
+            assert(P3PageTableGet(user->pid, &table) == P1_SUCCESS);
+            table[user->page].write = 0;
+            assert(USLOSS_MmuSetPageTable(table) == USLOSS_MMU_OK);
+        }
+    }
+}
+
+// Drops the users of a pinned or shared frame whose page tables no longer
+// map it, then frees the frame, gives it back to its one remaining user or
+// leaves it shared, and wakes the processes waiting for the merger. state
+// is the frame's state before it was pinned. Returns the frame's new
+// state, which the caller passes to FrameSettled once it has released
+// frameSem. Caller must hold frameSem.
+static int FrameSettle(int frame, int state) {
+    Frame *f = &framesList[frame];
+    Sharer *kept = NULL;
+    Sharer *user, *next;
+    PID pid = -1;
+    int page = -1;
+    int count = 0;
+
+    if (FrameMaps(f->pid, f->page, frame)) {
+        pid = f->pid;
+        page = f->page;
+        count++;
+    }
+    for (user = f->sharers; user != NULL; user = next) {
+        next = user->next;
+        if (!FrameMaps(user->pid, user->page, frame)) {
+            free(user);
+            continue;
+        }
+        if (count == 0) {
+            pid = user->pid;
+            page = user->page;
+            free(user);
+        } else {
+            user->next = kept;
+            kept = user;
+        }
+        count++;
+    }
+    f->sharers = kept;
+    if (f->state == P3_FRAME_MAPPED) {
+        mappedFrames--;
+    }
+    f->state = P3_FRAME_BUSY;
+    sharedFrames += (count > 1) - (state == P3_FRAME_SHARED);
+    if (count == 0) {
+        FramePush(frame);
+    } else if (count == 1) {
+        USLOSS_PTE *table;
+        assert(P3PageTableGet(pid, &table) == P1_SUCCESS);
+        table[page].write = 1;
+        if (state == P3_FRAME_SHARED) {
+            // the dirty bits of the pages merged into the frame are gone
+            int access;
+            assert(USLOSS_MmuGetAccess(frame, &access) == USLOSS_MMU_OK);
+            assert(USLOSS_MmuSetAccess(frame, access | USLOSS_MMU_DIRTY) == USLOSS_MMU_OK);
+        }
+        assert(USLOSS_MmuSetPageTable(table) == USLOSS_MMU_OK);
+        f->pid = pid;
+        f->page = page;
+        f->state = P3_FRAME_MAPPED;
+        mappedFrames++;
+    } else {
+        f->pid = pid;
+        f->page = page;
+        f->state = P3_FRAME_SHARED;
+    }
+    while (mergeWaiters > 0) {
+        mergeWaiters--;
+        assert(P1_V(mergeWait) == P1_SUCCESS);
+    }
+    return f->state;
+}
+
+// Tells the swap code about a frame that FrameSettle left in state, once
+// frameSem has been released: a mapped frame may be replaced again, and
+// the policy forgets a frame whose pages are all gone.
+static void FrameSettled(int frame, int state) {
+    if (state == P3_FRAME_MAPPED) {
+        assert(P3SwapWake() == P1_SUCCESS);
+    } else if (state == P3_FRAME_FREE) {
+        assert(P3SwapForget(frame) == P1_SUCCESS);
+    }
+}
+
+// Reserves a mapping window for the calling kernel process. Its own page
+// table is used if it has one, otherwise an empty one is allocated for it.
+static void WindowCreate(void) {
+    PID pid = P1_GetPid();
+    Window *window = &windows[pid];
+    USLOSS_PTE *table;
+    int ret = P3PageTableGet(pid, &table);
+    assert(ret == P1_SUCCESS);
+    window->allocated = (table == NULL);
+    if (table == NULL) {
+        table = calloc(numPages, sizeof(USLOSS_PTE));
+        assert(table != NULL);
+        assert(P3PageTableSet(pid, table) == P1_SUCCESS);
+    }
+    window->slots = numPages < WINDOW_SLOTS ? numPages : WINDOW_SLOTS;
+    window->used = 0;
+    window->table = table;
+}
+
+// Releases the calling process's mapping window.
+static void WindowDestroy(void) {
+    PID pid = P1_GetPid();
+    Window *window = &windows[pid];
+    assert(window->used == 0);
+    if (window->allocated) {
+        assert(P3PageTableSet(pid, NULL) == P1_SUCCESS);
+        free(window->table);
+    }
+    window->table = NULL;
+    window->allocated = FALSE;
+}
+
+// Maps frame at slot of the calling process's window, read-only unless
+// write is set, without claiming it through P3FrameMap so that frames
+// someone else has mapped can be looked at too. Returns the address of the
+// slot.
+static void *WindowPeek(int slot, int frame, int write) {
+    Window *window = &windows[P1_GetPid()];
+    int pages;
+    assert(window->table != NULL && slot < window->slots && !(window->used & (1 << slot)));
+    window->table[slot].frame = frame;
+    window->table[slot].incore = 1;
+    window->table[slot].read = 1;
+    window->table[slot].write = write;
+    assert(USLOSS_MmuSetPageTable(window->table) == USLOSS_MMU_OK);
+    return (char *) USLOSS_MmuRegion(&pages) + slot * USLOSS_MmuPageSize();
+}
+
+// Removes a mapping made by WindowPeek.
+static void WindowUnpeek(int slot) {
+    Window *window = &windows[P1_GetPid()];
+    window->table[slot].incore = 0;
+    window->table[slot].read = 0;
+    window->table[slot].write = 0;
+    assert(USLOSS_MmuSetPageTable(window->table) == USLOSS_MMU_OK);
+}
+
+// Copies frame from into frame to. A kernel process copies through its
+// window. The process faulting on a merged page has none, so it loads
+// copyTable instead, with interrupts off so that nothing runs while its
+// own page table is not loaded. Caller must hold frameSem.
+static void FrameCopy(int to, int from) {
+    int pageSize = USLOSS_MmuPageSize();
+    if (windows[P1_GetPid()].table != NULL) {
+        memcpy(WindowPeek(1, to, TRUE), WindowPeek(0, from, FALSE), pageSize);
+        WindowUnpeek(0);
+        WindowUnpeek(1);
+        return;
+    }
+    int pages;
+    char *region = USLOSS_MmuRegion(&pages);
+    USLOSS_PTE *table;
+    assert(P3PageTableGet(P1_GetPid(), &table) == P1_SUCCESS && table != NULL);
+    unsigned int psr = USLOSS_PsrGet();
+    assert(USLOSS_PsrSet(psr & ~USLOSS_PSR_CURRENT_INT) == USLOSS_DEV_OK);
+    copyTable[0].frame = from;
+    copyTable[0].incore = 1;
+    copyTable[0].read = 1;
+    copyTable[0].write = 0;
+    copyTable[1].frame = to;
+    copyTable[1].incore = 1;
+    copyTable[1].read = 1;
+    copyTable[1].write = 1;
+    assert(USLOSS_MmuSetPageTable(copyTable) == USLOSS_MMU_OK);
+    memcpy(region + pageSize, region, pageSize);
+    copyTable[0].incore = 0;
+    copyTable[1].incore = 0;
+    assert(USLOSS_MmuSetPageTable(table) == USLOSS_MMU_OK);
+    assert(USLOSS_PsrSet(psr) == USLOSS_DEV_OK);
+}
+
+// Copies the shared frame that page of pid maps read-only into frame copy
+// and gives up the page's share of the shared frame, leaving the page
+// unmapped. Returns FALSE, doing nothing, if the page doesn't map a shared
+// frame any more.
+static int ShareDetach(PID pid, int page, int copy) {
+    USLOSS_PTE *table;
+    assert(P3PageTableGet(pid, &table) == P1_SUCCESS && table != NULL);
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    int frame = table[page].frame;
+    if (!table[page].incore || table[page].write ||
+        framesList[frame].state != P3_FRAME_SHARED) {
+        assert(P1_V(frameSem) == P1_SUCCESS);
+        return FALSE;
+    }
+    // nobody writes a shared frame, so the page can be copied out of it
+    FrameCopy(copy, frame);
+    table[page].incore = 0;
+    table[page].read = 0;
+    table[page].write = 0;
+    int state = FrameSettle(frame, P3_FRAME_SHARED);
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    assert(USLOSS_MmuSetPageTable(table) == USLOSS_MMU_OK);
+    FrameSettled(frame, state);
+    return TRUE;
+}
+
+// Maps page of pid to the frame that was filled with its copy, once the
+// swap code has been told about the frame.
+static void CopyInstall(PID pid, int page, int frame) {
+    assert(P3SwapNotify(pid, page, frame) == P1_SUCCESS);
+    FrameInstall(pid, page, frame);
+    // the page's dirty bit was lost when it was merged
+    assert(USLOSS_MmuSetAccess(frame, USLOSS_MMU_DIRTY) == USLOSS_MMU_OK);
+    assert(P1_P(vmStatsSem) == P1_SUCCESS);
+    P3_vmStats.cowFaults += 1;
+    assert(P1_V(vmStatsSem) == P1_SUCCESS);
+}
+
+// Removes a fault from the in-flight table and wakes the duplicates that
+// attached to it.
+static void FaultWakeDups(Fault *fault, int status) {
+    assert(P1_P(faultPoolSem) == P1_SUCCESS);
+    InflightRemove(fault);
+    Fault *dup = fault->dups;
+    fault->dups = NULL;
+    while (dup != NULL) {
+        Fault *next = dup->next;
+        dup->status = status;
+        dup->state = FAULT_DONE;
+        assert(P1_V(dup->wait) == P1_SUCCESS);
+        dup = next;
+    }
+    assert(P1_V(faultPoolSem) == P1_SUCCESS);
+}
+
+// Hands a serviced fault back to the process waiting on it, along with any
+// duplicates that attached to it.
+static void FaultComplete(PagerStruct *pager, Fault *fault, int status) {
+    assert(fault->state == FAULT_INFLIGHT && pager->inflight == fault);
+    pager->inflight = NULL;
+    FaultWakeDups(fault, status);
+    fault->status = status;
+    fault->state = FAULT_DONE;
+    assert(P1_V(fault->wait) == P1_SUCCESS);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // End of Helper Functions
 ///////////////////////////////////////////////////////////////////////////////
@@ -103,11 +772,10 @@ static void checkInKernelMode() {
  * P3FrameInit --
  *
  *  Initializes the frame data structures.
- *  Four states of a frame:
- *      FRAME_UNUSED
- *      FRAME_INUSE
- *      FRAME_ASSIGNED
- *      FRAME_MAPPED
+ *  Three states of a frame:
+ *      P3_FRAME_FREE
+ *      P3_FRAME_BUSY
+ *      P3_FRAME_MAPPED
  *
  * Results:
  *   P3_ALREADY_INITIALIZED:    this function has already been called
@@ -130,27 +798,35 @@ P3FrameInit(int pages, int frames)
         assert(P1_SemCreate(frameSemName, 1, &frameSem) == P1_SUCCESS);
         assert(P1_P(frameSem) == P1_SUCCESS);
 
-        // initialize the frame data structures, e.g. the pool of  frames
-        framesList = malloc(sizeof(Frame) * frames);
-        int i;
-        for(i = 0; i < frames; i++){
-            framesList[i].state = FRAME_UNUSED;
-            framesList[i].pid = -1;
-        }
-        assert(P1_V(frameSem) == P1_SUCCESS);
-
         // creating semaphore for vmStats
         char vmStatsName[P1_MAXNAME];
         strcpy(vmStatsName, "vmStatsSem");
         assert(P1_SemCreate(vmStatsName, 1, &vmStatsSem) == P1_SUCCESS);
         assert(P1_P(vmStatsSem) == P1_SUCCESS);
-
-        // set P3_vmStats.freeFrames
-        P3_vmStats.freeFrames = frames;
+        P3_vmStats.freeFrames = 0;
         P3_vmStats.frames = frames;
-
         assert(P1_V(vmStatsSem) == P1_SUCCESS);
 
+        // initialize the frame data structures, e.g. the pool of  frames
+        framesList = malloc(sizeof(Frame) * frames);
+        frameNext = malloc(sizeof(int) * frames);
+        copyTable = calloc(pages, sizeof(USLOSS_PTE));
+        assert(framesList != NULL && frameNext != NULL && copyTable != NULL);
+        freeFrameHead = -1;
+        zeroFrameHead = -1;
+        mappedFrames = 0;
+        sharedFrames = 0;
+        int i;
+        // push in reverse so frame 0 is handed out first
+        for(i = frames - 1; i >= 0; i--){
+            framesList[i].state = P3_FRAME_FREE;
+            framesList[i].mapPage = -1;
+            framesList[i].mapTable = NULL;
+            framesList[i].sharers = NULL;
+            FramePush(i);
+        }
+        assert(P1_V(frameSem) == P1_SUCCESS);
+
     } else {
         result = P3_ALREADY_INITIALIZED;
     }
@@ -181,8 +857,22 @@ P3FrameShutdown(void)
     } else {
         // free frameList
         assert(P1_P(frameSem) == P1_SUCCESS);
+        int i;
+        for (i = 0; i < P3_vmStats.frames; i++) {
+            while (framesList[i].sharers != NULL) {
+                Sharer *next = framesList[i].sharers->next;
+                free(framesList[i].sharers);
+                framesList[i].sharers = next;
+            }
+        }
         free(framesList);
         framesList = NULL;
+        free(frameNext);
+        frameNext = NULL;
+        free(copyTable);
+        copyTable = NULL;
+        freeFrameHead = -1;
+        zeroFrameHead = -1;
         // Free Semaphores for frame and vmStats
         assert(P1_V(frameSem) == P1_SUCCESS);
         assert(P1_SemFree(frameSem) == P1_SUCCESS);
@@ -215,19 +905,37 @@ P3FrameFreeAll(int pid)
         return P3_NOT_INITIALIZED;
     }
     int i;
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    // pages being read ahead for the process are not mapped
+    seqInfo[pid].gen++;
+    assert(P1_V(frameSem) == P1_SUCCESS);
     for (i =0; i<numPages; i++) {  
+        int frame = -1;
+        int state = -1;
+        assert(P1_P(frameSem) == P1_SUCCESS);
         if (table[i].incore == 1) {
-            framesList[table[i].frame].state = FRAME_UNUSED;
-            framesList[table[i].frame].pid = -1;
+            frame = table[i].frame;
+            // a frame that is being evicted now belongs to the evicting
+            // pager, and one the merger is working on to the merger
+            if (framesList[frame].state == P3_FRAME_MAPPED &&
+                framesList[frame].pid == pid && framesList[frame].page == i) {
+                FramePush(frame);
+            }
             table[i].incore = 0;
             table[i].frame = -1;
             table[i].read = 0;
             table[i].write = 0;
+            if (framesList[frame].state == P3_FRAME_SHARED) {
+                // the frame stays with the processes still sharing it
+                state = FrameSettle(frame, P3_FRAME_SHARED);
+            }
         }
+        assert(P1_V(frameSem) == P1_SUCCESS);
+        FrameSettled(frame, state);
     }
-    assert(P1_P(vmStatsSem) == P1_SUCCESS);
-    P3_vmStats.freeFrames = P3_vmStats.frames;
-    assert(P1_V(vmStatsSem) == P1_SUCCESS);
+    seqInfo[pid].lastPage = -1;
+    seqInfo[pid].stride = 0;
+    seqInfo[pid].run = 0;
     ret = USLOSS_MmuSetPageTable(table);
     assert(ret == USLOSS_MMU_OK);
     return P1_SUCCESS;
@@ -238,11 +946,13 @@ P3FrameFreeAll(int pid)
  *
  * P3FrameMap --
  *
- *  Maps a frame to an unused page and returns a pointer to it.
+ *  Maps a frame to an unused page and returns a pointer to it. A pager
+ *  uses a slot in its own mapping window; any other caller borrows an
+ *  unused page in the page table of the frame's owner.
  *
  * Results:
  *   P3_NOT_INITIALIZED:    P3FrameInit has not been called
- *   P3_OUT_OF_PAGES:       process has no free pages
+ *   P3_OUT_OF_PAGES:       no free window slot or owner page
  *   P1_INVALID_FRAME       the frame number is invalid
  *   P1_SUCCESS:            success
  *
@@ -252,43 +962,59 @@ int
 P3FrameMap(int frame, void **ptr) 
 {
     USLOSS_PTE *table;
-    if (frame < 0 || frame >= P3_vmStats.frames || framesList[frame].state != FRAME_UNUSED) {
+    if (frame < 0 || frame >= P3_vmStats.frames ||
+        framesList[frame].state == P3_FRAME_FREE || framesList[frame].mapPage != -1) {
         return P3_INVALID_FRAME;
     }
-    // get the page table for the process (P3PageTableGet)
-    int ret = P3PageTableGet(framesList[frame].pid, &table);
-    if (ret != P1_SUCCESS || table == NULL) {
-        return P3_NOT_INITIALIZED;
-    }
+    Window *window = &windows[P1_GetPid()];
     int pages;
     *ptr = USLOSS_MmuRegion(&pages);
     int pageSize = USLOSS_MmuPageSize();
+    int ret;
 
-    // find an unused page
+    // find an unused page, in the caller's window if it has one, otherwise
+    // in the page table of the frame's owner
     int i;
-    for (i=0; i<pages; i++) {
-        if (table[i].incore == 0) {
-            // update the page's PTE to map the page to the frame
-            table[i].frame = frame;
-            table[i].incore = 1;
-            table[i].read = 1;
-            table[i].write = 1;
-
-            framesList[frame].state = FRAME_MAPPED;
-            // Moving the ptr to the page that we found
-            *ptr += i * pageSize; 
-            // Update the page table in the MMU (USLOSS_MmuSetPageTable)
-            ret = USLOSS_MmuSetPageTable(table);
-            assert(ret == USLOSS_MMU_OK);
-            // assert(P3PageTableSet(framesList[frame].pid, table) == P1_SUCCESS);
-            assert(P1_P(vmStatsSem) == P1_SUCCESS);
-            P3_vmStats.freeFrames -= 1;
-            assert(P1_V(vmStatsSem) == P1_SUCCESS);
-
-            return P1_SUCCESS;
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    if (window->table != NULL) {
+        table = window->table;
+        for (i = 0; i < window->slots && (window->used & (1 << i)); i++) {
+            continue;
+        }
+        if (i == window->slots) {
+            assert(P1_V(frameSem) == P1_SUCCESS);
+            return P3_OUT_OF_PAGES;
+        }
+        window->used |= 1 << i;
+    } else {
+        ret = P3PageTableGet(framesList[frame].pid, &table);
+        if (ret != P1_SUCCESS || table == NULL) {
+            assert(P1_V(frameSem) == P1_SUCCESS);
+            return P3_NOT_INITIALIZED;
+        }
+        for (i = 0; i < pages && table[i].incore; i++) {
+            continue;
+        }
+        if (i == pages) {
+            assert(P1_V(frameSem) == P1_SUCCESS);
+            return P3_OUT_OF_PAGES;
         }
     }
-    return P3_OUT_OF_PAGES;
+    // update the page's PTE to map the page to the frame
+    table[i].frame = frame;
+    table[i].incore = 1;
+    table[i].read = 1;
+    table[i].write = 1;
+
+    framesList[frame].mapPage = i;
+    framesList[frame].mapTable = table;
+    // Moving the ptr to the page that we found
+    *ptr += i * pageSize; 
+    // Update the page table in the MMU (USLOSS_MmuSetPageTable)
+    ret = USLOSS_MmuSetPageTable(table);
+    assert(ret == USLOSS_MMU_OK);
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    return P1_SUCCESS;
 }
 /*
  *----------------------------------------------------------------------
@@ -308,113 +1034,413 @@ P3FrameMap(int frame, void **ptr)
 int
 P3FrameUnmap(int frame) 
 {
-    USLOSS_PTE *table;
     if (frame < 0 || frame >= P3_vmStats.frames) {
         return P3_INVALID_FRAME;
     }
-    // get the process's page table (P3PageTableGet)
-    int ret = P3PageTableGet(framesList[frame].pid, &table);
-    if (ret != P1_SUCCESS || table == NULL) {
-        return P3_NOT_INITIALIZED;
-    }
     // verify that the process mapped the frame
-    int i;
-    for (i=0; i<numPages; i++) {
-        if (table[i].incore == 1 && table[i].frame == frame) {
-            // update page's PTE to remove the mapping
-            table[i].incore = 0;
-            table[i].read = 0;
-            table[i].write = 0;
-            framesList[frame].state = FRAME_UNUSED;
-            assert(P1_P(vmStatsSem) == P1_SUCCESS);
-            P3_vmStats.freeFrames += 1;
-            assert(P1_V(vmStatsSem) == P1_SUCCESS);
-            // update the page table in the MMU (USLOSS_MmuSetPageTable);
-            ret = USLOSS_MmuSetPageTable(table);
-            assert(ret == USLOSS_MMU_OK);
-            return P1_SUCCESS;
-        }
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    int i = framesList[frame].mapPage;
+    USLOSS_PTE *table = framesList[frame].mapTable;
+    if (i == -1 || table[i].incore == 0 || table[i].frame != frame) {
+        assert(P1_V(frameSem) == P1_SUCCESS);
+        return P3_FRAME_NOT_MAPPED;
+    }
+    // update page's PTE to remove the mapping
+    table[i].incore = 0;
+    table[i].read = 0;
+    table[i].write = 0;
+    framesList[frame].mapPage = -1;
+    framesList[frame].mapTable = NULL;
+    Window *window = &windows[P1_GetPid()];
+    if (window->table == table) {
+        window->used &= ~(1 << i);
     }
-    return P3_FRAME_NOT_MAPPED;
+    // update the page table in the MMU (USLOSS_MmuSetPageTable);
+    int ret = USLOSS_MmuSetPageTable(table);
+    assert(ret == USLOSS_MMU_OK);
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    return P1_SUCCESS;
 }
-
 /*
  *----------------------------------------------------------------------
  *
- * FaultHandler --
+ * P3FrameInfo --
  *
- *  Page fault interrupt handler
+ *  Looks up a frame in the reverse map.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3FrameInit has not been called
+ *   P3_INVALID_FRAME:      the frame number is invalid
+ *   P1_SUCCESS:            success
  *
  *----------------------------------------------------------------------
  */
-
-static void
-FaultHandler(int type, void *arg)
+int
+P3FrameInfo(int frame, PID *pid, int *page, int *state)
 {
-    Fault*   fault = malloc(sizeof(Fault));
-    // mutex for vmStats
-    assert(P1_P(vmStatsSem) == P1_SUCCESS);
-    P3_vmStats.faults += 1;
-    assert(P1_V(vmStatsSem) == P1_SUCCESS);
-
-    assert(P1_P(faultListSem) == P1_SUCCESS);
-    // fill in other fields in fault
-    fault->pid = P1_GetPid();
-    fault->offset = (int) arg;
-    fault->cause = USLOSS_MmuGetCause();
-    char name[P1_MAXNAME + 1];
-    snprintf(name,sizeof(name),"%s%d","fault", fault->pid);
-    assert(P1_SemCreate(name, 0, &(fault->wait)) == P1_SUCCESS);
-    if (fault->cause == USLOSS_MMU_ERR_ACC) {
-        P2_Terminate(USLOSS_MMU_ERR_ACC);
-    }
-    // add to queue of pending faults
-    if (faultHead == NULL) {
-        faultHead = fault;
-        faultTail = fault;
-    } else {
-        faultTail->next = fault;
-        faultTail = faultTail->next;
-    }
-    assert(P1_V(faultListSem) == P1_SUCCESS);
-    // Let the pagers know there is a pending fault
-    
-    assert(P1_V(faultSem) == P1_SUCCESS); // Notifying the pagers that a fault has ocurred
-    assert(P1_P(fault->wait) == P1_SUCCESS);
-    // wait for fault to be handled
-    assert(P1_P(faultListSem) == P1_SUCCESS);
-    // assert(P1_SemFree(fault->wait) == P1_SUCCESS);
-
-    if (faultHead->status == P3_OUT_OF_SWAP) {
-        P2_Terminate(P3_OUT_OF_SWAP);
+    if (framesList == NULL) {
+        return P3_NOT_INITIALIZED;
     }
-    assert(P1_SemFree(fault->wait) == P1_SUCCESS);
-    if (faultHead == faultTail && faultHead != NULL) {
-        // assert(P1_SemFree(faultHead->wait));
-        free(faultHead);
-        faultHead = NULL;
-        faultTail = NULL;
-    } else if (faultHead != NULL){
-        // assert(P1_SemFree(faultHead->wait));
-        Fault *fault = faultHead;
-        faultHead = faultHead->next;
-        free(fault);
+    if (frame < 0 || frame >= P3_vmStats.frames) {
+        return P3_INVALID_FRAME;
     }
-    
-    assert(P1_V(faultListSem) == P1_SUCCESS);
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    *pid = framesList[frame].pid;
+    *page = framesList[frame].page;
+    *state = framesList[frame].state;
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    return P1_SUCCESS;
 }
 
-
 /*
  *----------------------------------------------------------------------
  *
- * P3PagerInit --
+ * P3FrameEvict --
  *
- *  Initializes the pagers.
+ *  Marks a mapped frame busy so the caller can evict the page it holds,
+ *  and returns the page's owner. The caller is responsible for removing
+ *  the mapping from the owner's page table; the frame stays busy and is
+ *  handed to the pager that asked for it.
  *
  * Results:
- *   P3_ALREADY_INITIALIZED: this function has already been called
- *   P3_INVALID_NUM_PAGERS:  the number of pagers is invalid
+ *   P3_NOT_INITIALIZED:    P3FrameInit has not been called
+ *   P3_INVALID_FRAME:      the frame number is invalid
+ *   P3_FRAME_NOT_MAPPED:   the frame is free or already busy
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3FrameEvict(int frame, PID *pid, int *page)
+{
+    int result = P1_SUCCESS;
+    if (framesList == NULL) {
+        return P3_NOT_INITIALIZED;
+    }
+    if (frame < 0 || frame >= P3_vmStats.frames) {
+        return P3_INVALID_FRAME;
+    }
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    if (framesList[frame].state != P3_FRAME_MAPPED) {
+        result = P3_FRAME_NOT_MAPPED;
+    } else {
+        framesList[frame].state = P3_FRAME_BUSY;
+        mappedFrames--;
+        *pid = framesList[frame].pid;
+        *page = framesList[frame].page;
+    }
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3FrameKeep --
+ *
+ *  Undoes P3FrameEvict when the page can't be evicted after all. The
+ *  frame is mapped again; the caller is responsible for restoring the
+ *  mapping in the owner's page table first. If the owner's page table
+ *  doesn't map the frame, because the owner has quit, P3FrameFreeAll
+ *  has already passed the frame by, so it is freed instead.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3FrameInit has not been called
+ *   P3_INVALID_FRAME:      the frame number is invalid or not busy
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3FrameKeep(int frame)
+{
+    int result = P1_SUCCESS;
+    if (framesList == NULL) {
+        return P3_NOT_INITIALIZED;
+    }
+    if (frame < 0 || frame >= P3_vmStats.frames) {
+        return P3_INVALID_FRAME;
+    }
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    if (framesList[frame].state != P3_FRAME_BUSY) {
+        result = P3_INVALID_FRAME;
+    } else if (!FrameMaps(framesList[frame].pid, framesList[frame].page, frame)) {
+        FramePush(frame);
+    } else {
+        framesList[frame].state = P3_FRAME_MAPPED;
+        mappedFrames++;
+    }
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3FrameWindowCreate --
+ *
+ *  Reserves a mapping window for the calling kernel process, so that
+ *  its P3FrameMap calls use a slot of its own page table instead of a
+ *  page of the frame owner's.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3FrameInit has not been called
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3FrameWindowCreate(void)
+{
+    if (framesList == NULL) {
+        return P3_NOT_INITIALIZED;
+    }
+    WindowCreate();
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3FrameWindowDestroy --
+ *
+ *  Releases the calling process's mapping window. No frame may be
+ *  mapped through it.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    the process has no window
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3FrameWindowDestroy(void)
+{
+    if (windows[P1_GetPid()].table == NULL) {
+        return P3_NOT_INITIALIZED;
+    }
+    WindowDestroy();
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FaultZeroInline --
+ *
+ *  Resolves a fault on a page that has never been written to swap in the
+ *  faulting process's own context, skipping the round trip through a
+ *  pager. Only used when a free frame is available.
+ *
+ * Results:
+ *   TRUE:      the page is mapped
+ *   FALSE:     the fault must be handed to a pager
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+FaultZeroInline(PID pid, int page)
+{
+    if ((freeFrameHead == -1 && zeroFrameHead == -1) ||
+        P3SwapQuery(pid, page) != P3_EMPTY_PAGE) {
+        return FALSE;
+    }
+    int zeroed;
+    int frame = FrameClaim(pid, page, &zeroed);
+    if (frame == -1) {
+        return FALSE;
+    }
+    // no disk I/O here, this just records the frame with the swap code
+    int ret = P3SwapIn(pid, page, frame);
+    if (ret == P3_OUT_OF_SWAP) {
+        FrameUnclaim(frame);
+        P2_Terminate(P3_OUT_OF_SWAP);
+    }
+    assert(ret == P3_EMPTY_PAGE || ret == P1_SUCCESS);
+    if (ret == P3_EMPTY_PAGE && !zeroed) {
+        // zero the frame through the faulting page itself; the frame stays
+        // busy so the clock can't take it until FrameInstall marks it mapped
+        USLOSS_PTE *table;
+        int pages;
+        assert(P3PageTableGet(pid, &table) == P1_SUCCESS && table != NULL);
+        table[page].frame = frame;
+        table[page].incore = 1;
+        table[page].read = 1;
+        table[page].write = 1;
+        assert(USLOSS_MmuSetPageTable(table) == USLOSS_MMU_OK);
+        char *region = USLOSS_MmuRegion(&pages);
+        memset(region + page * USLOSS_MmuPageSize(), 0, USLOSS_MmuPageSize());
+    }
+    FrameInstall(pid, page, frame);
+    assert(P1_P(vmStatsSem) == P1_SUCCESS);
+    if (ret == P3_EMPTY_PAGE) {
+        P3_vmStats.new += 1;
+        P3_vmStats.preZeroed += zeroed;
+    }
+    P3_vmStats.inlineFaults += 1;
+    assert(P1_V(vmStatsSem) == P1_SUCCESS);
+    return TRUE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FaultCopyOnWrite --
+ *
+ *  Resolves an access fault on a page that is write-protected because
+ *  it was merged with another process's page. If a free frame is
+ *  available the faulting process is given a copy of the page in it,
+ *  in its own context like FaultZeroInline; otherwise a pager has to
+ *  replace a page to make room (CopyService). If the merger is still
+ *  comparing the page the process waits for it and retries the write.
+ *
+ * Results:
+ *   COW_RETRY:     the write can be retried
+ *   COW_PAGER:     the fault must be handed to a pager
+ *   COW_DENIED:    the fault is a real access violation
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+FaultCopyOnWrite(PID pid, int page)
+{
+    USLOSS_PTE *table;
+
+    if (page < 0 || page >= numPages ||
+        P3PageTableGet(pid, &table) != P1_SUCCESS || table == NULL) {
+        return COW_DENIED;
+    }
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    if (!table[page].incore || table[page].write) {
+        // already taken care of
+        assert(P1_V(frameSem) == P1_SUCCESS);
+        return COW_RETRY;
+    }
+    int frame = table[page].frame;
+    if (framesList[frame].state == P3_FRAME_BUSY) {
+        mergeWaiters++;
+        assert(P1_V(frameSem) == P1_SUCCESS);
+        assert(P1_P(mergeWait) == P1_SUCCESS);
+        return COW_RETRY;
+    }
+    if (framesList[frame].state != P3_FRAME_SHARED) {
+        assert(P1_V(frameSem) == P1_SUCCESS);
+        return COW_DENIED;
+    }
+    assert(P1_V(frameSem) == P1_SUCCESS);
+
+    int newFrame = FrameClaim(pid, page, NULL);
+    if (newFrame == -1) {
+        return COW_PAGER;
+    }
+    if (!ShareDetach(pid, page, newFrame)) {
+        // the merger got to the frame first, try again
+        FrameUnclaim(newFrame);
+        return COW_RETRY;
+    }
+    CopyInstall(pid, page, newFrame);
+    return COW_RETRY;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FaultHandler --
+ *
+ *  Page fault interrupt handler
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FaultHandler(int type, void *arg)
+{
+    // mutex for vmStats
+    assert(P1_P(vmStatsSem) == P1_SUCCESS);
+    P3_vmStats.faults += 1;
+    assert(P1_V(vmStatsSem) == P1_SUCCESS);
+
+    int cause = USLOSS_MmuGetCause();
+    if (cause == USLOSS_MMU_ERR_ACC) {
+        // a write to a merged page gets a copy of the page, made by a pager
+        // if there is no free frame for it
+        int cow = FaultCopyOnWrite(P1_GetPid(), (int) arg / USLOSS_MmuPageSize());
+        if (cow == COW_DENIED) {
+            P2_Terminate(USLOSS_MMU_ERR_ACC);
+        }
+        if (cow == COW_RETRY) {
+            return;
+        }
+    } else if (FaultZeroInline(P1_GetPid(), (int) arg / USLOSS_MmuPageSize())) {
+        // first touch of a page with a free frame available is handled right here
+        return;
+    }
+    assert(P1_P(faultPoolSem) == P1_SUCCESS);
+    Fault*   fault = FaultAlloc();
+    // fill in other fields in fault
+    fault->pid = P1_GetPid();
+    fault->offset = (int) arg;
+    fault->page = fault->offset / USLOSS_MmuPageSize();
+    fault->cause = cause;
+    fault->wait = faultWait[fault->pid];
+
+    // if the page is being read ahead, wait for that read instead
+    Fault *primary = InflightLookup(fault->pid, fault->page);
+    if (primary != NULL) {
+        fault->state = FAULT_ATTACHED;
+        fault->next = primary->dups;
+        primary->dups = fault;
+        assert(P1_V(faultPoolSem) == P1_SUCCESS);
+        assert(P1_P(vmStatsSem) == P1_SUCCESS);
+        P3_vmStats.coalesced += 1;
+        assert(P1_V(vmStatsSem) == P1_SUCCESS);
+        goto wait;
+    }
+    InflightInsert(fault);
+    assert(P1_V(faultPoolSem) == P1_SUCCESS);
+
+    // add to the queue of the pager that owns this process
+    PagerStruct *owner = &pagersList[fault->pid % numPagers];
+    FaultEnqueue(owner, fault);
+    assert(P1_V(owner->sid) == P1_SUCCESS);
+
+    // if the owner is busy let an idle pager steal the fault
+    if (!owner->idle) {
+        int i;
+        for (i = 0; i < numPagers; i++) {
+            if (pagersList[i].idle) {
+                pagersList[i].idle = 0;
+                assert(P1_V(pagersList[i].sid) == P1_SUCCESS);
+                break;
+            }
+        }
+    }
+
+wait:
+    // wait for fault to be handled
+    assert(P1_P(fault->wait) == P1_SUCCESS);
+    assert(fault->state == FAULT_DONE);
+
+    int status = fault->status;
+    assert(P1_P(faultPoolSem) == P1_SUCCESS);
+    FaultRelease(fault);
+    assert(P1_V(faultPoolSem) == P1_SUCCESS);
+    if (status == P3_OUT_OF_SWAP) {
+        P2_Terminate(P3_OUT_OF_SWAP);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3PagerInit --
+ *
+ *  Initializes the pagers.
+ *
+ * Results:
+ *   P3_ALREADY_INITIALIZED: this function has already been called
+ *   P3_INVALID_NUM_PAGERS:  the number of pagers is invalid
  *   P1_SUCCESS:             success
  *
  *----------------------------------------------------------------------
@@ -427,14 +1453,6 @@ P3PagerInit(int pages, int frames, int pagers)
     checkInKernelMode();
     USLOSS_IntVec[USLOSS_MMU_INT] = FaultHandler;
 
-    // creating semaphore for the fault handler to switch to the pagers
-    char faultSemName[P1_MAXNAME];
-    strcpy(faultSemName, "faultSem");
-    assert(P1_SemCreate(faultSemName, 0, &faultSem) == P1_SUCCESS);
-    char faultListSemName[P1_MAXNAME];
-    strcpy(faultListSemName, "faultList");
-    assert(P1_SemCreate(faultListSemName, 1, &faultListSem) == P1_SUCCESS);
-
     if(initialized){
         result = P3_ALREADY_INITIALIZED;
     } else if (pagers <= 0 || pagers > P3_MAX_PAGERS){
@@ -443,15 +1461,65 @@ P3PagerInit(int pages, int frames, int pagers)
         // initialize the pager data structures
         initialized = 1;
         int i;
+        // build the fault pool and the per-process wait semaphores
+        char faultPoolSemName[P1_MAXNAME];
+        strcpy(faultPoolSemName, "faultPool");
+        assert(P1_SemCreate(faultPoolSemName, 1, &faultPoolSem) == P1_SUCCESS);
+        faultFree = NULL;
+        for(i = 0; i < FAULT_HASH_SIZE; i++) {
+            inflightTable[i] = NULL;
+        }
+        for(i = FAULT_POOL_SIZE - 1; i >= 0; i--) {
+            faultPool[i].pid = -1;
+            faultPool[i].wait = -1;
+            faultPool[i].next = faultFree;
+            faultFree = &faultPool[i];
+        }
+        for(i = 0; i < P1_MAXPROC; i++) {
+            seqInfo[i].lastPage = -1;
+            seqInfo[i].stride = 0;
+            seqInfo[i].run = 0;
+            seqInfo[i].gen = 0;
+
+            char name[P1_MAXNAME + 1];
+            snprintf(name, sizeof(name), "%s%d", "fault", i);
+            assert(P1_SemCreate(name, 0, &faultWait[i]) == P1_SUCCESS);
+        }
         for(i = 0; i < P3_MAX_PAGERS; i++) {
             pagersList[i].pid = -1;
             pagersList[i].sid = -1;
             pagersList[i].quit = 0;
+            pagersList[i].idle = 0;
+            pagersList[i].mutex = -1;
+            pagersList[i].faultHead = NULL;
+            pagersList[i].faultTail = NULL;
+            pagersList[i].count = 0;
+            pagersList[i].inflight = NULL;
         }
+        reclaimer.pid = -1;
+        reclaimer.sid = -1;
+        reclaimer.quit = 0;
+        reclaimer.awake = FALSE;
+        zeroer.pid = -1;
+        zeroer.sid = -1;
+        zeroer.quit = 0;
+        zeroer.awake = FALSE;
+        merger.pid = -1;
+        merger.sid = -1;
+        merger.quit = 0;
+        merger.awake = FALSE;
+        mergeWaiters = 0;
+        assert(P3WatermarksGet(&lowWater, &highWater) == P1_SUCCESS);
+        assert(P3MergingGet(&mergeInterval) == P1_SUCCESS);
 
         // fork off the pagers and wait for them to start running
+        char pagersDoneName[P1_MAXNAME];
+        strcpy(pagersDoneName, "pagersDone");
+        assert(P1_SemCreate(pagersDoneName, 0, &pagersDone) == P1_SUCCESS);
         for(i = 0; i < pagers; i++){
             char name[P1_MAXNAME + 1];
+            snprintf(name,sizeof(name),"%s%d","pagerQueue",i);
+            assert(P1_SemCreate(name,1,&pagersList[i].mutex) == P1_SUCCESS);
             snprintf(name,sizeof(name),"%s%d","pager",i);
             assert(P1_SemCreate(name,0,&pagersList[i].sid) == P1_SUCCESS);
 
@@ -462,7 +1530,46 @@ P3PagerInit(int pages, int frames, int pagers)
             assert(P1_P(pagersList[i].sid) == P1_SUCCESS);
             // assert(P1_V(pagersList[i].sid) == P1_SUCCESS);
         }
-        
+
+        // fork off the reclaimer and wait for it to start running
+        if (lowWater > 0) {
+            char name[P1_MAXNAME + 1];
+            strcpy(name, "reclaimerDone");
+            assert(P1_SemCreate(name, 0, &reclaimerDone) == P1_SUCCESS);
+            strcpy(name, "reclaimer");
+            assert(P1_SemCreate(name, 0, &reclaimer.sid) == P1_SUCCESS);
+            assert(P1_Fork(name, Reclaim, NULL, USLOSS_MIN_STACK, P3_PAGER_PRIORITY, 1,
+                           &reclaimer.pid) == P1_SUCCESS);
+            assert(P1_P(reclaimer.sid) == P1_SUCCESS);
+        }
+
+        // fork off the zeroer, it starts out awake to zero the initial frames
+        char name[P1_MAXNAME + 1];
+        strcpy(name, "zeroerDone");
+        assert(P1_SemCreate(name, 0, &zeroerDone) == P1_SUCCESS);
+        strcpy(name, "zeroer");
+        SID sid;
+        assert(P1_SemCreate(name, 0, &sid) == P1_SUCCESS);
+        zeroer.awake = TRUE;
+        zeroer.sid = sid;
+        assert(P1_Fork(name, Zero, NULL, USLOSS_MIN_STACK, ZEROER_PRIORITY, 1,
+                       &zeroer.pid) == P1_SUCCESS);
+        assert(P1_P(zeroer.sid) == P1_SUCCESS);
+
+        // fork off the merger, which compares pages two at a time through
+        // its window; it runs at the pagers' priority because a pager
+        // looking for a victim may be waiting for the two frames it holds
+        strcpy(name, "mergeWait");
+        assert(P1_SemCreate(name, 0, &mergeWait) == P1_SUCCESS);
+        if (mergeInterval > 0 && pages >= 2) {
+            strcpy(name, "mergerDone");
+            assert(P1_SemCreate(name, 0, &mergerDone) == P1_SUCCESS);
+            strcpy(name, "merger");
+            assert(P1_SemCreate(name, 0, &merger.sid) == P1_SUCCESS);
+            assert(P1_Fork(name, Merge, NULL, USLOSS_MIN_STACK, P3_PAGER_PRIORITY, 1,
+                           &merger.pid) == P1_SUCCESS);
+            assert(P1_P(merger.sid) == P1_SUCCESS);
+        }
     }
     return result;
 }
@@ -491,19 +1598,264 @@ P3PagerShutdown(void)
         initialized = 0;
         
         // cause the pagers to quit
-        for(i = 0; i < P3_MAX_PAGERS; i++) {
-            if(pagersList[i].quit != -1){
-                // setting the pagerList[i] to quit
-                pagersList[i].quit = 1;
-                assert(P1_V(faultSem) == P1_SUCCESS); // Shutting down the pagers
-            }
+        for(i = 0; i < numPagers; i++) {
+            // setting the pagerList[i] to quit
+            pagersList[i].quit = 1;
+            assert(P1_V(pagersList[i].sid) == P1_SUCCESS); // Shutting down the pagers
+        }
+        // the reclaimer may be in the middle of writing out a batch, which
+        // needs the swap structures
+        if (reclaimer.sid != -1) {
+            SID sid = reclaimer.sid;
+            reclaimer.quit = 1;
+            assert(P1_V(sid) == P1_SUCCESS);
+            assert(P1_P(reclaimerDone) == P1_SUCCESS);
+            reclaimer.sid = -1;
+            assert(P1_SemFree(sid) == P1_SUCCESS);
+            assert(P1_SemFree(reclaimerDone) == P1_SUCCESS);
         }
+        // the zeroer can be preempted in the middle of a frame, wait for it
+        // to finish before the frames go away
+        SID sid = zeroer.sid;
+        zeroer.quit = 1;
+        assert(P1_V(sid) == P1_SUCCESS);
+        assert(P1_P(zeroerDone) == P1_SUCCESS);
+        zeroer.sid = -1;
+        assert(P1_SemFree(sid) == P1_SUCCESS);
+        assert(P1_SemFree(zeroerDone) == P1_SUCCESS);
 
-        // clean up the pager data structures
+        // the merger notices within a second
+        if (merger.sid != -1) {
+            merger.quit = 1;
+            assert(P1_P(mergerDone) == P1_SUCCESS);
+            assert(P1_SemFree(merger.sid) == P1_SUCCESS);
+            assert(P1_SemFree(mergerDone) == P1_SUCCESS);
+            merger.sid = -1;
+        }
+        assert(P1_SemFree(mergeWait) == P1_SUCCESS);
+
+        // clean up the pager data structures once the pagers are gone
+        for(i = 0; i < numPagers; i++) {
+            assert(P1_P(pagersDone) == P1_SUCCESS);
+        }
+        assert(P1_SemFree(pagersDone) == P1_SUCCESS);
+        for(i = 0; i < numPagers; i++) {
+            assert(P1_SemFree(pagersList[i].sid) == P1_SUCCESS);
+            assert(P1_SemFree(pagersList[i].mutex) == P1_SUCCESS);
+            pagersList[i].sid = -1;
+            pagersList[i].mutex = -1;
+        }
+        for(i = 0; i < P1_MAXPROC; i++) {
+            assert(P1_SemFree(faultWait[i]) == P1_SUCCESS);
+        }
+        assert(P1_SemFree(faultPoolSem) == P1_SUCCESS);
+        faultFree = NULL;
     }
     return result;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReadAhead --
+ *
+ *  Brings in up to READAHEAD_PAGES pages of pid that follow page along
+ *  stride and are on the swap disk. Only free frames are used; pages are
+ *  never evicted to make room. Called after the fault on page has been
+ *  completed, so the process runs while the pages are read; each page is
+ *  registered in the in-flight table while it is read so a fault on it
+ *  waits rather than reading it a second time. gen is the process's
+ *  seqInfo generation when it faulted on page; if the process quits in
+ *  the meantime, the pages are dropped.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+ReadAhead(PID pid, int page, int stride, int gen)
+{
+    Fault   *records[READAHEAD_PAGES];
+    int     pages[READAHEAD_PAGES];
+    int     frames[READAHEAD_PAGES];
+    int     results[READAHEAD_PAGES];
+    int     count = 0;
+
+    int next;
+    for (next = page + stride; count < READAHEAD_PAGES &&
+         next >= 0 && next < numPages; next += stride) {
+        if (!PageMissing(pid, next, gen)) {
+            continue;
+        }
+        int frame = FrameClaim(pid, next, NULL);
+        if (frame == -1) {
+            break;
+        }
+        // a fault on the page either has been serviced by now, so the page
+        // is in memory, or is in the table, or will attach to our record
+        assert(P1_P(faultPoolSem) == P1_SUCCESS);
+        if (InflightLookup(pid, next) != NULL || !PageMissing(pid, next, gen)) {
+            assert(P1_V(faultPoolSem) == P1_SUCCESS);
+            FrameUnclaim(frame);
+            continue;
+        }
+        Fault *record = FaultAlloc();
+        record->pid = pid;
+        record->page = next;
+        record->offset = next * USLOSS_MmuPageSize();
+        record->state = FAULT_INFLIGHT;
+        InflightInsert(record);
+        assert(P1_V(faultPoolSem) == P1_SUCCESS);
+
+        records[count] = record;
+        pages[count] = next;
+        frames[count] = frame;
+        count++;
+    }
+    if (count == 0) {
+        return;
+    }
+    assert(P3SwapInCluster(pid, count, pages, frames, results) == P1_SUCCESS);
+
+    int i;
+    int numRead = 0;
+    for (i = 0; i < count; i++) {
+        if (results[i] == P1_SUCCESS) {
+            numRead += FrameInstallAhead(pid, pages[i], frames[i], gen);
+        } else {
+            FrameUnclaim(frames[i]);
+        }
+        // a duplicate that attached to a page that wasn't read just faults again
+        FaultWakeDups(records[i], P1_SUCCESS);
+        assert(P1_P(faultPoolSem) == P1_SUCCESS);
+        FaultRelease(records[i]);
+        assert(P1_V(faultPoolSem) == P1_SUCCESS);
+    }
+    // the next fault in the sequence will be past the pages read ahead,
+    // unless the process has faulted again meanwhile
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    if (seqInfo[pid].gen == gen && seqInfo[pid].lastPage == page) {
+        seqInfo[pid].lastPage = pages[count - 1];
+    }
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    assert(P1_P(vmStatsSem) == P1_SUCCESS);
+    P3_vmStats.readAhead += numRead;
+    assert(P1_V(vmStatsSem) == P1_SUCCESS);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CopyService --
+ *
+ *  Gives the page of a write fault on a merged page a frame of its own
+ *  holding a copy of it, replacing a page to get the frame. Used when
+ *  FaultCopyOnWrite found no free frame.
+ *
+ * Results:
+ *   P3_OUT_OF_SWAP:         the faulting process must be killed
+ *   P1_SUCCESS:             the write can be retried
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+CopyService(Fault *fault)
+{
+    int frame = FrameClaim(fault->pid, fault->page, NULL);
+    if (frame == -1) {
+        int rc = P3SwapOut(&frame);
+        if (rc == P3_OUT_OF_SWAP) {
+            return P3_OUT_OF_SWAP;
+        }
+        assert(rc == P1_SUCCESS);
+        FrameAssign(frame, fault->pid, fault->page);
+    }
+    if (!ShareDetach(fault->pid, fault->page, frame)) {
+        // the page was unshared while a page was replaced for it; the
+        // process retries the write and faults again if it has to
+        FrameUnclaim(frame);
+        return P1_SUCCESS;
+    }
+    CopyInstall(fault->pid, fault->page, frame);
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FaultService --
+ *
+ *  Brings in the page for a fault owned by the calling pager. If the
+ *  process is faulting sequentially, *stride is set to the stride to
+ *  read ahead along once the fault is completed, otherwise to 0.
+ *
+ * Results:
+ *   P3_OUT_OF_SWAP:         the faulting process must be killed
+ *   P1_SUCCESS:             the page is mapped
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+FaultService(Fault *fault, int *stride)
+{
+    int pageSize = USLOSS_MmuPageSize();
+    int page = fault->page;
+    *stride = 0;
+    if (fault->cause == USLOSS_MMU_ERR_ACC) {
+        return CopyService(fault);
+    }
+    // a new page prefers a frame the zeroer has already cleared
+    int zeroed = FALSE;
+    int frame = FrameClaim(fault->pid, page,
+                           P3SwapQuery(fault->pid, page) == P3_EMPTY_PAGE ? &zeroed : NULL);
+    if (frame == -1) {
+        // no free frame, replace one
+        int rc = P3SwapOut(&frame);
+        if (rc == P3_OUT_OF_SWAP) {
+            // every victim is dirty and has nowhere to go
+            return P3_OUT_OF_SWAP;
+        }
+        assert(rc == P1_SUCCESS);
+        FrameAssign(frame, fault->pid, page);
+    }
+    int ret = P3SwapIn(fault->pid, page, frame);
+    // if rc == P3_EMPTY_PAGE
+    if (ret == P3_EMPTY_PAGE) {
+        // New page, add to vmStats
+        assert(P1_P(vmStatsSem) == P1_SUCCESS);
+        P3_vmStats.new += 1;
+        P3_vmStats.preZeroed += zeroed;
+        assert(P1_V(vmStatsSem) == P1_SUCCESS);
+        if (!zeroed) {
+            void *addr;
+            assert(P3FrameMap(frame, &addr) == P1_SUCCESS);
+            // Zero out the frame at the given address
+            memset(addr, 0, pageSize);
+            assert(P3FrameUnmap(frame) == P1_SUCCESS);
+        }
+    } else if (ret == P3_OUT_OF_SWAP) {
+        //  kill the faulting process
+        FrameUnclaim(frame);
+        return P3_OUT_OF_SWAP;
+    }
+    // update PTE in faulting process's page table to map page to frame
+    FrameInstall(fault->pid, page, frame);
+
+    // look for a sequential pattern to read ahead along
+    SeqInfo *seq = &seqInfo[fault->pid];
+    int delta = page - seq->lastPage;
+    if (seq->lastPage != -1 && delta != 0 && delta == seq->stride) {
+        seq->run++;
+    } else {
+        seq->stride = delta;
+        seq->run = 1;
+    }
+    seq->lastPage = page;
+    if (seq->run >= READAHEAD_RUN && delta >= -READAHEAD_STRIDE &&
+        delta <= READAHEAD_STRIDE) {
+        *stride = delta;
+    }
+    return P1_SUCCESS;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -518,56 +1870,333 @@ static int
 Pager(void *arg)
 {
     int pagerCount = *((int *)arg);
+    PagerStruct *self = &pagersList[pagerCount];
+    WindowCreate();
     //  notify P3PagerInit that we are running
-    assert(P1_V(pagersList[pagerCount].sid) == P1_SUCCESS);
+    assert(P1_V(self->sid) == P1_SUCCESS);
 
     // loop until P3PagerShutdown is called
-    while(initialized != 0) {
-        assert(P1_P(faultSem) == P1_SUCCESS);
-        if (faultHead != NULL) {
-            int frame;
-             // if there are free frames
-            if (P3_vmStats.freeFrames > 0) {
-                int i;
-                // frame = a free frame
-                for (i=0; i<P3_vmStats.frames; i++) {
-                    if (framesList[i].state == FRAME_UNUSED) {
-                        frame = i;
-                        break;
-                    }
-                }
-            } else {
-                // P3SwapOut(&frame);
-                assert(P3SwapOut(&frame) == P1_SUCCESS);
-                framesList[frame].state = FRAME_UNUSED;
+    while(!self->quit) {
+        self->idle = 1;
+        assert(P1_P(self->sid) == P1_SUCCESS);
+        self->idle = 0;
+        // service our own queue first, then help the busiest pager
+        while (!self->quit) {
+            Fault *fault = FaultDequeue(self);
+            if (fault == NULL) {
+                fault = FaultSteal(self);
+            }
+            if (fault == NULL) {
+                break;
+            }
+            // the fault now belongs to this pager until it is completed
+            fault->state = FAULT_INFLIGHT;
+            fault->pager = pagerCount;
+            self->inflight = fault;
+            // the fault record goes back to the process once it is completed
+            PID pid = fault->pid;
+            int page = fault->page;
+            int gen = seqInfo[pid].gen;
+            int stride;
+            FaultComplete(self, fault, FaultService(fault, &stride));
+            // read ahead while the process runs again
+            if (stride != 0) {
+                ReadAhead(pid, page, stride, gen);
+            }
+        }
+    }
+    WindowDestroy();
+    assert(P1_V(pagersDone) == P1_SUCCESS);
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Reclaim --
+ *
+ *  The reclaimer daemon. Sleeps until the number of free frames drops
+ *  below the low watermark, then evicts pages in batches with
+ *  P3SwapOutBatch (which writes dirty pages to swap) and frees their
+ *  frames until the high watermark is reached.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+Reclaim(void *arg)
+{
+    WindowCreate();
+    //  notify P3PagerInit that we are running
+    assert(P1_V(reclaimer.sid) == P1_SUCCESS);
+
+    while (!reclaimer.quit) {
+        assert(P1_P(reclaimer.sid) == P1_SUCCESS);
+        while (!reclaimer.quit) {
+            // stop at the high watermark, or when every frame in use is
+            // already being filled or evicted by someone else
+            assert(P1_P(frameSem) == P1_SUCCESS);
+            int want = highWater - P3_vmStats.freeFrames;
+            if (want <= 0 || mappedFrames == 0) {
+                reclaimer.awake = FALSE;
+                assert(P1_V(frameSem) == P1_SUCCESS);
+                break;
+            }
+            assert(P1_V(frameSem) == P1_SUCCESS);
+
+            // evict a batch of pages in one pass of the replacement policy
+            int frames[P3_MAX_CLUSTER];
+            int count;
+            if (want > P3_MAX_CLUSTER) {
+                want = P3_MAX_CLUSTER;
+            }
+            if (P3SwapOutBatch(want, frames, &count) != P1_SUCCESS || count == 0) {
+                assert(P1_P(frameSem) == P1_SUCCESS);
+                reclaimer.awake = FALSE;
+                assert(P1_V(frameSem) == P1_SUCCESS);
+                break;
+            }
+            int i;
+            for (i = 0; i < count; i++) {
+                FrameUnclaim(frames[i]);
+            }
+            assert(P1_P(vmStatsSem) == P1_SUCCESS);
+            P3_vmStats.reclaimed += count;
+            assert(P1_V(vmStatsSem) == P1_SUCCESS);
+        }
+    }
+    WindowDestroy();
+    assert(P1_V(reclaimerDone) == P1_SUCCESS);
+    return 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Zero --
+ *
+ *  The zeroing daemon. Runs at low priority, takes frames off the free
+ *  stack, fills them with zeros and moves them to the zero stack. It
+ *  sleeps when the free stack is empty and FramePush wakes it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+Zero(void *arg)
+{
+    int pageSize = USLOSS_MmuPageSize();
+    WindowCreate();
+    //  notify P3PagerInit that we are running
+    assert(P1_V(zeroer.sid) == P1_SUCCESS);
+
+    while (!zeroer.quit) {
+        while (!zeroer.quit) {
+            // the frame is busy while it is zeroed so nobody else claims it,
+            // but it still counts as free
+            assert(P1_P(frameSem) == P1_SUCCESS);
+            int frame = FramePop(&freeFrameHead);
+            if (frame == -1) {
+                zeroer.awake = FALSE;
+                assert(P1_V(frameSem) == P1_SUCCESS);
+                break;
+            }
+            framesList[frame].state = P3_FRAME_BUSY;
+            assert(P1_V(frameSem) == P1_SUCCESS);
+
+            void *addr;
+            assert(P3FrameMap(frame, &addr) == P1_SUCCESS);
+            memset(addr, 0, pageSize);
+            assert(P3FrameUnmap(frame) == P1_SUCCESS);
+
+            assert(P1_P(frameSem) == P1_SUCCESS);
+            framesList[frame].state = P3_FRAME_FREE;
+            frameNext[frame] = zeroFrameHead;
+            zeroFrameHead = frame;
+            assert(P1_V(frameSem) == P1_SUCCESS);
+        }
+        assert(P1_P(zeroer.sid) == P1_SUCCESS);
+    }
+    WindowDestroy();
+    assert(P1_V(zeroerDone) == P1_SUCCESS);
+    return 0;
+}
+
+// A mapped frame's hash. The frames are sorted by hash so that the ones
+// that may hold the same data are next to each other.
+typedef struct FrameHash {
+    unsigned int hash;
+    int frame;
+    int live;   // not merged into another frame during this pass
+} FrameHash;
+
+static int
+FrameHashCompare(const void *a, const void *b)
+{
+    unsigned int ha = ((const FrameHash *) a)->hash;
+    unsigned int hb = ((const FrameHash *) b)->hash;
+    return (ha > hb) - (ha < hb);
+}
+
+// Hashes the contents of a page.
+static unsigned int
+PageHash(const void *addr, int size)
+{
+    const unsigned int *word = addr;
+    unsigned int hash = 2166136261u;
+    int i;
+    for (i = 0; i < size / (int) sizeof(unsigned int); i++) {
+        hash = (hash ^ word[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MergeFrames --
+ *
+ *  Merges the page in frame fb into frame fa if the two frames hold the
+ *  same data. fb must be mapped by a process other than fa's owner; fa
+ *  may already be shared. Both frames are pinned and every page mapped
+ *  to them is write-protected while they are compared.
+ *
+ * Results:
+ *   TRUE:      fb's page now maps fa and fb is free
+ *   FALSE:     the frames were not merged
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+MergeFrames(int fa, int fb)
+{
+    Frame *a = &framesList[fa];
+    Frame *b = &framesList[fb];
+
+    // fb's page joins fa's sharers if the frames are merged
+    Sharer *sharer = malloc(sizeof(Sharer));
+    if (sharer == NULL) {
+        return FALSE;
+    }
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    if (b->state != P3_FRAME_MAPPED || b->mapPage != -1 ||
+        (a->state != P3_FRAME_MAPPED && a->state != P3_FRAME_SHARED) || a->pid == b->pid ||
+        (a->state == P3_FRAME_MAPPED && sharedFrames >= P3_vmStats.frames / 2)) {
+        assert(P1_V(frameSem) == P1_SUCCESS);
+        free(sharer);
+        return FALSE;
+    }
+    int stateA = FramePin(fa);
+    int stateB = FramePin(fb);
+    FrameProtect(fa);
+    FrameProtect(fb);
+    assert(P1_V(frameSem) == P1_SUCCESS);
+
+    int same = memcmp(WindowPeek(0, fa, FALSE), WindowPeek(1, fb, FALSE), USLOSS_MmuPageSize()) == 0;
+    WindowUnpeek(0);
+    WindowUnpeek(1);
+
+    // the writeback daemon may have mapped fb to write it out meanwhile,
+    // and fb's owner may have quit
+    assert(P1_P(frameSem) == P1_SUCCESS);
+    if (same && b->mapPage == -1 && FrameMaps(b->pid, b->page, fb)) {
+        USLOSS_PTE *table;
+        assert(P3PageTableGet(b->pid, &table) == P1_SUCCESS);
+        table[b->page].frame = fa;
+        assert(USLOSS_MmuSetPageTable(table) == USLOSS_MMU_OK);
+        sharer->pid = b->pid;
+        sharer->page = b->page;
+        sharer->next = a->sharers;
+        a->sharers = sharer;
+    } else {
+        same = FALSE;
+        free(sharer);
+    }
+    stateB = FrameSettle(fb, stateB);
+    stateA = FrameSettle(fa, stateA);
+    assert(P1_V(frameSem) == P1_SUCCESS);
+    // pagers may have found every frame busy while the two were pinned
+    FrameSettled(fb, stateB);
+    FrameSettled(fa, stateA);
+    if (same) {
+        assert(P1_P(vmStatsSem) == P1_SUCCESS);
+        P3_vmStats.merged += 1;
+        assert(P1_V(vmStatsSem) == P1_SUCCESS);
+    }
+    return same;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Merge --
+ *
+ *  The merging daemon. Every mergeInterval seconds it hashes the frames
+ *  that hold pages, sorts them by hash and tries to merge the frames
+ *  whose hashes match. The frames are not pinned while they are hashed,
+ *  so a hash may be stale; MergeFrames compares the pages themselves.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+Merge(void *arg)
+{
+    int frames = P3_vmStats.frames;
+    int pageSize = USLOSS_MmuPageSize();
+    FrameHash *hashes = malloc(frames * sizeof(FrameHash));
+    assert(hashes != NULL);
+    WindowCreate();
+    //  notify P3PagerInit that we are running
+    assert(P1_V(merger.sid) == P1_SUCCESS);
+
+    while (TRUE) {
+        // P2_Sleep can't be cut short, so sleep a second at a time so that
+        // P3PagerShutdown doesn't wait for a whole interval
+        int slept;
+        for (slept = 0; slept < mergeInterval && !merger.quit; slept++) {
+            assert(P2_Sleep(1) == P1_SUCCESS);
+        }
+        if (merger.quit) {
+            break;
+        }
+        int i, j;
+        int count = 0;
+        for (i = 0; i < frames; i++) {
+            assert(P1_P(frameSem) == P1_SUCCESS);
+            int state = framesList[i].state;
+            assert(P1_V(frameSem) == P1_SUCCESS);
+            if (state == P3_FRAME_MAPPED || state == P3_FRAME_SHARED) {
+                hashes[count].hash = PageHash(WindowPeek(0, i, FALSE), pageSize);
+                hashes[count].frame = i;
+                hashes[count].live = TRUE;
+                WindowUnpeek(0);
+                count++;
             }
-            framesList[frame].pid = faultHead->pid;
-            int pageSize = USLOSS_MmuPageSize();
-            int page = faultHead->offset/pageSize;
-            int ret = P3SwapIn(faultHead->pid, page, frame);
-            // if rc == P3_EMPTY_PAGE
-            if (ret == P3_EMPTY_PAGE) {
-                // New page, add to vmStats
-                assert(P1_P(vmStatsSem) == P1_SUCCESS);
-                P3_vmStats.new += 1;
-                assert(P1_V(vmStatsSem) == P1_SUCCESS);
-                void *addr;
-                assert(P3FrameMap(frame, &addr) == P1_SUCCESS);
-                // Zero out the frame at the given address
-                memset(addr, 0, pageSize);
-                assert(P3FrameUnmap(frame) == P1_SUCCESS);
-            } else if (ret == P3_OUT_OF_SWAP) {
-                //  kill the faulting process
-                faultHead->status = P3_OUT_OF_SWAP;
-                assert(P1_V(faultHead->wait) == P1_SUCCESS);
+        }
+        qsort(hashes, count, sizeof(FrameHash), FrameHashCompare);
+        // only frames in the same run of equal hashes are compared
+        int start, end;
+        for (start = 0; start < count; start = end) {
+            for (end = start + 1; end < count && hashes[end].hash == hashes[start].hash; end++) {
                 continue;
             }
-            void *ptr;
-            // update PTE in faulting process's page table to map page to frame
-            assert(P3FrameMap(frame, &ptr) == P1_SUCCESS);
-            faultHead->status = P1_SUCCESS;
-            assert(P1_V(faultHead->wait) == P1_SUCCESS);
+            for (i = start; i < end; i++) {
+                for (j = i + 1; hashes[i].live && j < end; j++) {
+                    if (!hashes[j].live) {
+                        continue;
+                    }
+                    if (MergeFrames(hashes[i].frame, hashes[j].frame)) {
+                        hashes[j].live = FALSE;
+                    } else if (MergeFrames(hashes[j].frame, hashes[i].frame)) {
+                        hashes[i].live = FALSE;
+                    }
+                }
+            }
         }
     }
+    WindowDestroy();
+    free(hashes);
+    assert(P1_V(mergerDone) == P1_SUCCESS);
     return 0;
-}
\ No newline at end of file
+}
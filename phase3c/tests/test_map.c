@@ -106,6 +106,10 @@ int P3SwapInit(int pages, int frames) {return P1_SUCCESS;}
 int P3SwapShutdown(void) {return P1_SUCCESS;}
 int P3SwapFreeAll(PID pid) {return P1_SUCCESS;}
 int P3SwapOut(int *frame) {return P1_SUCCESS;}
+int P3SwapOutBatch(int max, int *frames, int *count) {
+    *count = 0;
+    return P1_SUCCESS;
+}
 int P3SwapIn(PID pid, int page, int frame) {
     int rc = 0;
     void *addr;
@@ -117,6 +121,16 @@ int P3SwapIn(PID pid, int page, int frame) {
     TEST(rc, P1_SUCCESS);
     return P1_SUCCESS;
 }
+int P3SwapInCluster(PID pid, int count, int *pages, int *frames, int *results) {
+    for (int i = 0; i < count; i++) {
+        results[i] = P3_EMPTY_PAGE;
+    }
+    return P1_SUCCESS;
+}
+int P3SwapQuery(PID pid, int page) {return P3_EMPTY_PAGE;}
+int P3SwapNotify(PID pid, int page, int frame) {return P1_SUCCESS;}
+int P3SwapWake(void) {return P1_SUCCESS;}
+int P3SwapForget(int frame) {return P1_SUCCESS;}
 
 
 
@@ -12,19 +12,33 @@ There are various shared resources that require proper synchronization.
 Swap space. Free swap space is a shared resource, we don't want multiple pagers choosing the
 same free space to hold a page. You'll need a mutex around the free swap space.
 
-The clock hand is also a shared resource.
+The state of the replacement policy (e.g. the clock hand) is also a shared resource; the
+policy hooks are only called with the mutex held.
 
 The frames are a shared resource in that we don't want multiple pagers to choose the same frame via
 the clock algorithm. That's the purpose of marking a frame as "busy" in the pseudo-code below. 
-Pagers ignore busy frames when running the clock algorithm.
+Pagers ignore busy frames when running the clock algorithm. The busy flag, and which page of which
+process a frame holds, live in the reverse map kept by Phase 3c (P3FrameInfo, P3FrameEvict); a
+frame stays busy from the moment it is chosen until the pager maps it for its new page.
 
 A process's page table is a shared resource with the pager. The process changes its page table
 when it quits, and a pager changes the page table when it selects one of the process's pages
 in the clock algorithm. 
 
-Normally the pagers would perform I/O concurrently, which means they would release the mutex
-while performing disk I/O. I made it simpler by having the pagers hold the mutex while they perform
-disk I/O.
+Dirty frames can also be written back in the background by the writer daemon while they stay
+mapped (see ScheduleWriteback). A frame waiting for or undergoing writeback is skipped by the
+replacement policies, and its block is marked busy while it is written.
+
+The compressed page store is protected by the mutex as well. Pages are compressed and
+decompressed with the mutex held; when the writer spills a page from the store to disk it marks
+the page's block busy for the write, like any other page going out.
+
+The pagers perform I/O concurrently, so they release the mutex while performing disk I/O. The
+frame involved is marked busy for the duration so the clock skips it, and a page being written
+out has its block marked busy so that a pager swapping the same page back in waits for the write
+to finish (see WaitForIO). A pager that finds every frame busy waits the same way; phase 3c calls
+P3SwapWake whenever it makes a frame mapped again, since those frames become busy and mapped
+without any I/O here.
 
 ***************/
 
@@ -59,35 +73,492 @@ typedef struct Block {
     int track;
     int sector;
     int isSwapped;
+    int busy;       // page is being written to this block
+    int valid;      // page is in memory and the block holds the same data
+    char *zdata;    // compressed copy of the page, NULL if none
+    int zsize;      // # of bytes in zdata
+    int zstamp;     // when the page left memory, 0 while it is resident
+    struct Block *older;    // neighbours on the store's list of pages out
+    struct Block *newer;    // of memory, while zstamp isn't 0
+    PID pid;        // owner of the block
+    int page;
 } Block;
 
 typedef struct Pages{
     Block *block;
+    int generation; // bumped each time the process frees its swap space
+    int quit;       // has freed its swap space, and its pid not faulted since
 } Pages;
 
-typedef struct Frame{
-    int pid;
-    int page;
-    int isBusy;
-} Frame;
-
-typedef struct Node {
-    Block block;
-    struct Node *next;
-} Node;
 
 static int initialized = 0;
 static SID semSwap;
 static SID semVMStats;
 static Pages *processes;
-static Node *freeBlocks; // A stack of the free blocks
 static int num_pages;
 static int num_frames;
-static Frame *frame_processes;
 static int sector_size;
 static int num_sectors; // Number of sectors per track
 static int num_tracks;  // Total number of tracks
 static int sectors_per_page;
+// Swap slots are page-sized runs of sectors; slot i starts at sector
+// i * sectors_per_page counting from track 0. swapMap has one bit per
+// slot, set while the slot is in use. Protected by semSwap.
+#define SLOT_BITS   32
+static unsigned int *swapMap;
+static int num_slots;
+static int swapHint;    // word of swapMap the next search starts at
+
+// Swap is handed out to processes in extents: page p of a process goes in
+// slot p % extent_slots of the extent that holds its pages
+// p - p % extent_slots, so consecutive pages land in consecutive sectors.
+// Extents start on a multiple of extent_slots, which is a track boundary
+// when the disk geometry allows it. Slots are still allocated one at a
+// time, so when no whole extent is free a page takes any free slot.
+static int extent_slots;
+static int extents_per_proc;
+static int *extents;    // first slot of each process's extents, -1 if none
+static int extentHint;  // extent the next search starts at
+static SID semIO;       // pagers waiting for a busy block or frame block here
+static int ioWaiters;   // # of pagers blocked on semIO
+
+// Background writeback, protected by semSwap. Frames are queued once, in a
+// circular queue with room for every frame.
+static int *writeback;      // frame is queued for or undergoing writeback
+static int *wbQueue;
+static int wbHead;
+static int wbCount;
+static SID semWriter;       // wakes the writer, one V per queued frame or spill
+static SID semWriterDone;   // V'd by the writer when it starts and when it exits
+static int writerQuit;
+static int Writer(void *arg);
+
+// Compressed page store, protected by semSwap. A dirty victim that
+// compresses well is kept in memory instead of being written to disk, and
+// like a swap block its copy stays while the page is resident again. When
+// the store passes STORE_HIGH percent of storeLimit the writer moves the
+// copies of the pages that have been out longest to disk until it is down
+// to STORE_LOW percent. A page's data is in the store or on disk, never
+// both. The blocks of the pages out of memory with a copy in the store are
+// kept on a list in zstamp order, oldest first, so the writer doesn't have
+// to search for them.
+#define STORE_HIGH  90
+#define STORE_LOW   75
+static int storeLimit;      // bytes the store may hold, 0 if it is disabled
+static int storeBytes;
+static int storeClock;      // stamps pages as they leave memory
+static Block *storeOldest;  // list of the pages out of memory
+static Block *storeNewest;
+static int storeSpill;      // the writer has been asked to spill
+static unsigned char *storeScratch;
+
+/*
+ * A page replacement policy. P3SwapOut asks the policy for a victim; the
+ * other hooks let it track what happens to frames. Every hook is called
+ * with semSwap held, and any hook but select may be NULL.
+ *
+ *  init        the swap system is starting with the given # of frames
+ *  done        the swap system is shutting down
+ *  select      chooses a mapped frame, takes it with P3FrameEvict and
+ *              returns it with its owner and its access bits
+ *  faultIn     a page was read or zeroed into a frame
+ *  reference   a mapped frame's access bits were sampled (SampleAccess)
+ *  free        the page in a frame is gone: its process quit, or phase 3c
+ *              freed the frame (P3SwapForget)
+ *  quit        a process is freeing its swap space, so its pid may be reused
+ */
+typedef struct Policy {
+    char    *name;
+    void    (*init)(int frames);
+    void    (*done)(void);
+    void    (*select)(int *frame, PID *pid, int *page, int *access);
+    void    (*faultIn)(int frame, PID pid, int page);
+    void    (*reference)(int frame, int access);
+    void    (*free)(int frame);
+    void    (*quit)(PID pid);
+} Policy;
+
+static void ClockInit(int frames);
+static void ClockSelect(int *frame, PID *pid, int *page, int *access);
+static void NruInit(int frames);
+static void NruSelect(int *frame, PID *pid, int *page, int *access);
+static void WsInit(int frames);
+static void WsDone(void);
+static void WsSelect(int *frame, PID *pid, int *page, int *access);
+static void WsFaultIn(int frame, PID pid, int page);
+static void ProInit(int frames);
+static void ProDone(void);
+static void ProSelect(int *frame, PID *pid, int *page, int *access);
+static void ProFaultIn(int frame, PID pid, int page);
+static void ProFree(int frame);
+static void ProQuit(PID pid);
+static void AgingInit(int frames);
+static void AgingDone(void);
+static void AgingSelect(int *frame, PID *pid, int *page, int *access);
+static void AgingFaultIn(int frame, PID pid, int page);
+static void AgingReference(int frame, int access);
+static void AgingFree(int frame);
+
+static Policy policies[P3_NUM_POLICIES] = {
+    [P3_POLICY_CLOCK] = {"clock", ClockInit, NULL, ClockSelect, NULL, NULL, NULL, NULL},
+    [P3_POLICY_NRU] = {"nru", NruInit, NULL, NruSelect, NULL, NULL, NULL, NULL},
+    [P3_POLICY_WSCLOCK] = {"wsclock", WsInit, WsDone, WsSelect, WsFaultIn, NULL, NULL, NULL},
+    [P3_POLICY_CLOCKPRO] = {"clockpro", ProInit, ProDone, ProSelect, ProFaultIn, NULL, ProFree,
+                            ProQuit},
+    [P3_POLICY_AGING] = {"aging", AgingInit, AgingDone, AgingSelect, AgingFaultIn,
+                         AgingReference, AgingFree, NULL},
+};
+static Policy *policy;
+
+// A frame chosen by the policy in P3SwapOutBatch.
+typedef struct Victim {
+    int     frame;
+    PID     pid;
+    int     page;
+    int     access;
+    Block   *block;     // swap block, if the page has to be written
+    int     generation; // owner's generation when chosen, -1 if it was quitting
+} Victim;
+
+static int Evictable(int frame, PID *pid, int *page);
+static int AnyEvictable(void);
+static int BlockAddress(Block *block);
+
+static void
+StatsAdd(int *counter, int n)
+{
+    assert(P1_P(semVMStats) == P1_SUCCESS);
+    *counter += n;
+    assert(P1_V(semVMStats) == P1_SUCCESS);
+}
+
+/*
+ * Allocates a swap slot, -1 if there are none left. Called with semSwap held.
+ */
+static int
+SlotAlloc(void)
+{
+    int words = (num_slots + SLOT_BITS - 1) / SLOT_BITS;
+    int i;
+    for (i = 0; i < words; i++) {
+        int w = (swapHint + i) % words;
+        if (swapMap[w] != ~0u) {
+            int slot = w * SLOT_BITS + __builtin_ctz(~swapMap[w]);
+            if (slot >= num_slots) {
+                // unused bits past the end of the last word
+                continue;
+            }
+            swapMap[w] |= 1u << (slot % SLOT_BITS);
+            swapHint = w;
+            StatsAdd(&P3_vmStats.freeBlocks, -1);
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Tells whether a slot is in use. Called with semSwap held.
+ */
+static int
+SlotUsed(int slot)
+{
+    return (swapMap[slot / SLOT_BITS] >> (slot % SLOT_BITS)) & 1;
+}
+
+/*
+ * Allocates the slot for a page of a process in the process's extent for
+ * the page, giving it a new extent if it doesn't have one, or any free
+ * slot if that fails. Returns -1 if there are no slots left. Called with
+ * semSwap held.
+ */
+static int
+SlotAllocPage(PID pid, int page)
+{
+    int *extent = &extents[pid * extents_per_proc + page / extent_slots];
+    int num_extents = num_slots / extent_slots;
+    int i;
+    if (*extent == -1) {
+        // look for an extent that is entirely free
+        for (i = 0; i < num_extents && *extent == -1; i++) {
+            int e = (extentHint + i) % num_extents;
+            int k;
+            for (k = 0; k < extent_slots && !SlotUsed(e * extent_slots + k); k++) {
+                continue;
+            }
+            if (k == extent_slots) {
+                *extent = e * extent_slots;
+                extentHint = (e + 1) % num_extents;
+            }
+        }
+    }
+    if (*extent != -1) {
+        int slot = *extent + page % extent_slots;
+        if (!SlotUsed(slot)) {
+            swapMap[slot / SLOT_BITS] |= 1u << (slot % SLOT_BITS);
+            StatsAdd(&P3_vmStats.freeBlocks, -1);
+            return slot;
+        }
+    }
+    return SlotAlloc();
+}
+
+/*
+ * Gives a page its swap block the first time it has to be written out.
+ * Returns FALSE if the swap disk is full. Called with semSwap held.
+ */
+static int
+BlockAssign(PID pid, int page)
+{
+    Block *block = &processes[pid].block[page];
+    int slot = SlotAllocPage(pid, page);
+    if (slot == -1) {
+        return FALSE;
+    }
+    block->track = (slot * sectors_per_page) / num_sectors;
+    block->sector = (slot * sectors_per_page) % num_sectors;
+    debug3("Giving track %d and sector %d to %d\n", block->track, block->sector, pid);
+    return TRUE;
+}
+
+// LZ77 page compression. The output is groups of up to eight items, each
+// group preceded by a byte whose bit i is set if item i is a match rather
+// than a literal byte. A match is two bytes: a 12-bit distance back into
+// the output and a 4-bit length less LZ_MIN_MATCH.
+#define LZ_HASH_BITS    12
+#define LZ_MIN_MATCH    3
+#define LZ_MAX_MATCH    (LZ_MIN_MATCH + 15)
+#define LZ_MAX_OFFSET   4095
+
+/*
+ * Compresses len bytes of src into dst. Returns the compressed size, or
+ * -1 if it would be more than max bytes. Called with semSwap held, which
+ * protects the hash table.
+ */
+static int
+Compress(const unsigned char *src, int len, unsigned char *dst, int max)
+{
+    static int table[1 << LZ_HASH_BITS];
+    int in = 0;
+    int out = 0;
+    int flags = 0;
+    int bit = 8;
+    int i;
+
+    for (i = 0; i < (1 << LZ_HASH_BITS); i++) {
+        table[i] = -1;
+    }
+    while (in < len) {
+        if (bit == 8) {
+            if (out >= max) {
+                return -1;
+            }
+            flags = out++;
+            dst[flags] = 0;
+            bit = 0;
+        }
+        int matchLen = 0;
+        int offset = 0;
+        if (in + LZ_MIN_MATCH <= len) {
+            unsigned int key = (src[in] << 16) | (src[in + 1] << 8) | src[in + 2];
+            int h = (key * 2654435761u) >> (32 - LZ_HASH_BITS);
+            int candidate = table[h];
+            table[h] = in;
+            if (candidate >= 0 && in - candidate <= LZ_MAX_OFFSET) {
+                while (matchLen < LZ_MAX_MATCH && in + matchLen < len &&
+                       src[candidate + matchLen] == src[in + matchLen]) {
+                    matchLen++;
+                }
+                offset = in - candidate;
+            }
+        }
+        if (matchLen >= LZ_MIN_MATCH) {
+            if (out + 2 > max) {
+                return -1;
+            }
+            dst[flags] |= 1 << bit;
+            dst[out++] = offset >> 4;
+            dst[out++] = ((offset & 0xf) << 4) | (matchLen - LZ_MIN_MATCH);
+            in += matchLen;
+        } else {
+            if (out >= max) {
+                return -1;
+            }
+            dst[out++] = src[in++];
+        }
+        bit++;
+    }
+    return out;
+}
+
+/*
+ * Expands len bytes produced by Compress into the outLen bytes of dst.
+ */
+static void
+Decompress(const unsigned char *src, int len, unsigned char *dst, int outLen)
+{
+    int in = 0;
+    int out = 0;
+    int flags = 0;
+    int bit = 8;
+
+    while (in < len) {
+        if (bit == 8) {
+            flags = src[in++];
+            bit = 0;
+        }
+        if (flags & (1 << bit)) {
+            int offset = (src[in] << 4) | (src[in + 1] >> 4);
+            int n = (src[in + 1] & 0xf) + LZ_MIN_MATCH;
+            in += 2;
+            // byte by byte, as a match may overlap the bytes it produces
+            for (; n > 0; n--, out++) {
+                dst[out] = dst[out - offset];
+            }
+        } else {
+            dst[out++] = src[in++];
+        }
+        bit++;
+    }
+    assert(out == outLen);
+}
+
+/*
+ * Takes a page off the store's list of pages out of memory, if it is on
+ * it. Called with semSwap held.
+ */
+static void
+StoreUnstamp(Block *block)
+{
+    if (block->zstamp != 0) {
+        if (block->older != NULL) {
+            block->older->newer = block->newer;
+        } else {
+            storeOldest = block->newer;
+        }
+        if (block->newer != NULL) {
+            block->newer->older = block->older;
+        } else {
+            storeNewest = block->older;
+        }
+        block->older = NULL;
+        block->newer = NULL;
+        block->zstamp = 0;
+    }
+}
+
+/*
+ * Stamps a page with a compressed copy as it leaves memory and puts it
+ * at the end of the store's list. Called with semSwap held.
+ */
+static void
+StoreStamp(Block *block)
+{
+    StoreUnstamp(block);
+    block->zstamp = ++storeClock;
+    block->older = storeNewest;
+    if (storeNewest != NULL) {
+        storeNewest->newer = block;
+    } else {
+        storeOldest = block;
+    }
+    storeNewest = block;
+}
+
+/*
+ * Throws away a page's compressed copy, if it has one. Called with
+ * semSwap held.
+ */
+static void
+StoreDrop(Block *block)
+{
+    StoreUnstamp(block);
+    if (block->zdata != NULL) {
+        free(block->zdata);
+        storeBytes -= block->zsize;
+        block->zdata = NULL;
+        block->zsize = 0;
+    }
+}
+
+/*
+ * Compresses an evicted page into the store. Returns FALSE if the page
+ * doesn't shrink by at least a quarter or the store has no room or
+ * memory, in which case it has to go to disk. Called with semSwap held.
+ */
+static int
+StoreInsert(Block *block, int frame)
+{
+    void *ptr;
+    int pageSize = USLOSS_MmuPageSize();
+    int size;
+
+    if (storeLimit == 0) {
+        return FALSE;
+    }
+    assert(P3FrameMap(frame, &ptr) == P1_SUCCESS);
+    size = Compress(ptr, pageSize, storeScratch, pageSize * 3 / 4);
+    assert(P3FrameUnmap(frame) == P1_SUCCESS);
+    if (size == -1) {
+        return FALSE;
+    }
+    if (storeBytes + size > storeLimit * STORE_HIGH / 100 && !storeSpill) {
+        // make room for the pages that come after this one
+        storeSpill = TRUE;
+        assert(P1_V(semWriter) == P1_SUCCESS);
+    }
+    if (storeBytes + size > storeLimit) {
+        return FALSE;
+    }
+    block->zdata = malloc(size);
+    if (block->zdata == NULL) {
+        return FALSE;
+    }
+    memcpy(block->zdata, storeScratch, size);
+    block->zsize = size;
+    StoreStamp(block);
+    block->isSwapped = FALSE;
+    storeBytes += size;
+    return TRUE;
+}
+
+/*
+ * Returns a swap slot. Called with semSwap held.
+ */
+static void
+SlotFree(int slot)
+{
+    assert(swapMap[slot / SLOT_BITS] & (1u << (slot % SLOT_BITS)));
+    swapMap[slot / SLOT_BITS] &= ~(1u << (slot % SLOT_BITS));
+    StatsAdd(&P3_vmStats.freeBlocks, 1);
+}
+
+/*
+ * Waits for an in-progress read or write to finish, or for a frame to be mapped again.
+ * Called with semSwap held, which is released while waiting and reacquired before
+ * returning; callers must recheck any state they looked at.
+ */
+static void
+WaitForIO(void)
+{
+    ioWaiters++;
+    assert(P1_V(semSwap) == P1_SUCCESS);
+    assert(P1_P(semIO) == P1_SUCCESS);
+    assert(P1_P(semSwap) == P1_SUCCESS);
+}
+
+/*
+ * Wakes every pager blocked in WaitForIO. Called with semSwap held whenever a block stops
+ * being busy or a frame becomes replaceable.
+ */
+static void
+IODone(void)
+{
+    while (ioWaiters > 0) {
+        ioWaiters--;
+        assert(P1_V(semIO) == P1_SUCCESS);
+    }
+}
 
 
 /*
@@ -114,7 +585,6 @@ P3SwapInit(int pages, int frames)
     }else{
         num_pages = pages;
         num_frames = frames;
-        freeBlocks = NULL;
         // Initializing Semaphores
         char name_swap[P1_MAXNAME + 1];
         strcpy(name_swap,"swap_sem");
@@ -122,6 +592,10 @@ P3SwapInit(int pages, int frames)
         strcpy(name_vm,"vmStat_sem");
         assert(P1_SemCreate(name_swap,1,&semSwap) == P1_SUCCESS);
         assert(P1_SemCreate(name_vm,1,&semVMStats) == P1_SUCCESS);
+        char name_io[P1_MAXNAME + 1];
+        strcpy(name_io,"swap_io");
+        assert(P1_SemCreate(name_io,0,&semIO) == P1_SUCCESS);
+        ioWaiters = 0;
 
         // Initializing the disk
         assert(P2_DiskSize(1, &sector_size, &num_sectors, &num_tracks) == P1_SUCCESS);
@@ -131,46 +605,98 @@ P3SwapInit(int pages, int frames)
             sectors_per_page++;
         }
         USLOSS_Console("Sectors per page %d and num sectors %d\n", sectors_per_page, num_sectors);
-        int i; int j;
-        int startJ = 0;
-        // USLOSS_Console("Creating Free Block Space\n");
-        // Giving space for the freeBlocks stack
-        for (i=0; i<num_tracks; i++) {
-            for (j=startJ; j<num_sectors; j+=sectors_per_page) {
-                // USLOSS_Console("i %d j %d\n", i, j);
-                Node *node = malloc(sizeof(Node));
-                node->block.sector = j;
-                node->block.track = i;
-                node->block.isSwapped = FALSE;
-                node->next = freeBlocks;
-                freeBlocks = node;
-            }
-            startJ = j - num_sectors;
+        int i;
+        num_slots = (num_tracks * num_sectors) / sectors_per_page;
+        swapMap = calloc((num_slots + SLOT_BITS - 1) / SLOT_BITS, sizeof(unsigned int));
+        swapHint = 0;
+
+        // the smallest run of whole tracks that holds a whole number of
+        // slots, grown until an extent covers a cluster
+        int unit = 1;
+        while (unit <= num_tracks && (unit * num_sectors) % sectors_per_page != 0) {
+            unit++;
+        }
+        int tracks = unit;
+        while ((tracks * num_sectors) / sectors_per_page < P3_MAX_CLUSTER &&
+               tracks + unit <= num_tracks) {
+            tracks += unit;
+        }
+        extent_slots = (tracks * num_sectors) / sectors_per_page;
+        if (extent_slots > num_slots) {
+            // no track-aligned extent fits on the disk
+            extent_slots = (num_slots < P3_MAX_CLUSTER) ? num_slots : P3_MAX_CLUSTER;
+        }
+        if (extent_slots < 1) {
+            extent_slots = 1;
+        }
+        extents_per_proc = (pages + extent_slots - 1) / extent_slots;
+        extents = malloc(P1_MAXPROC * extents_per_proc * sizeof(int));
+        for (i = 0; i < P1_MAXPROC * extents_per_proc; i++) {
+            extents[i] = -1;
         }
+        extentHint = 0;
+        debug3("Swap extents of %d slots\n", extent_slots);
+        assert(P1_P(semVMStats) == P1_SUCCESS);
+        P3_vmStats.blocks = num_slots;
+        P3_vmStats.freeBlocks = num_slots;
+        assert(P1_V(semVMStats) == P1_SUCCESS);
         USLOSS_Console("Setting up proc ds\n");
         processes = malloc(P1_MAXPROC * sizeof(Pages));
         for(i = 0; i < P1_MAXPROC; i++){
             processes[i].block = malloc(pages * sizeof(Block));
+            processes[i].generation = 0;
+            processes[i].quit = FALSE;
             int j;
             for(j = 0; j < pages; j++) {
                 processes[i].block[j].track = -1;
                 processes[i].block[j].isSwapped = FALSE;
+                processes[i].block[j].valid = FALSE;
                 processes[i].block[j].sector = -1;
+                processes[i].block[j].busy = FALSE;
+                processes[i].block[j].zdata = NULL;
+                processes[i].block[j].zsize = 0;
+                processes[i].block[j].zstamp = 0;
+                processes[i].block[j].older = NULL;
+                processes[i].block[j].newer = NULL;
+                processes[i].block[j].pid = i;
+                processes[i].block[j].page = j;
             }
         }
+        int storeFrames;
+        assert(P3CompressionGet(&storeFrames) == P1_SUCCESS);
+        storeLimit = storeFrames * pageSize;
+        storeBytes = 0;
+        storeClock = 0;
+        storeOldest = NULL;
+        storeNewest = NULL;
+        storeSpill = FALSE;
+        storeScratch = malloc(pageSize);
 
-        // initialize the swap data structures, e.g. the pool of free blocks
-        USLOSS_Console("Initializing frames\n");
-        frame_processes = malloc(sizeof(Frame) * frames);
-        for(i = 0; i < frames; i ++){
-            frame_processes[i].pid = -1;
-            frame_processes[i].page = -1;
-            frame_processes[i].isBusy = FALSE;
-
+        writeback = malloc(frames * sizeof(int));
+        wbQueue = malloc(frames * sizeof(int));
+        for (i = 0; i < frames; i++) {
+            writeback[i] = FALSE;
         }
+        wbHead = 0;
+        wbCount = 0;
+        writerQuit = FALSE;
+        char name_wb[P1_MAXNAME + 1];
+        strcpy(name_wb, "swap_writer_done");
+        assert(P1_SemCreate(name_wb, 0, &semWriterDone) == P1_SUCCESS);
+        strcpy(name_wb, "swap_writer");
+        assert(P1_SemCreate(name_wb, 0, &semWriter) == P1_SUCCESS);
+        int pid;
+        assert(P1_Fork(name_wb, Writer, NULL, USLOSS_MIN_STACK, P3_PAGER_PRIORITY, 1,
+                       &pid) == P1_SUCCESS);
+        assert(P1_P(semWriterDone) == P1_SUCCESS);
 
-        assert(P1_P(semVMStats) == P1_SUCCESS);
-        assert(P1_V(semVMStats) == P1_SUCCESS);
+        policy = &policies[P3_vmStats.policy];
+        if (policy->init != NULL) {
+            assert(P1_P(semSwap) == P1_SUCCESS);
+            policy->init(frames);
+            assert(P1_V(semSwap) == P1_SUCCESS);
+        }
+        debug3("Using the %s replacement policy\n", policy->name);
         initialized = 1;
     }
     USLOSS_Console("SwapInit End\n");
@@ -197,21 +723,37 @@ P3SwapShutdown(void)
     if(!initialized){
         result = P3_NOT_INITIALIZED;
     }else{
-        // Frame structs
-        int i;
-        for (i=0; i<num_frames; i++) {
-            Frame *ptr = frame_processes + i;
-            free(ptr);
+        if (policy->done != NULL) {
+            assert(P1_P(semSwap) == P1_SUCCESS);
+            policy->done();
+            assert(P1_V(semSwap) == P1_SUCCESS);
         }
+        writerQuit = TRUE;
+        assert(P1_V(semWriter) == P1_SUCCESS);
+        assert(P1_P(semWriterDone) == P1_SUCCESS);
+        assert(P1_SemFree(semWriter) == P1_SUCCESS);
+        assert(P1_SemFree(semWriterDone) == P1_SUCCESS);
+        free(writeback);
+        free(wbQueue);
 
+        int i, j;
         for(i = 0; i < P1_MAXPROC; i++){
+            for (j = 0; j < num_pages; j++) {
+                StoreDrop(&processes[i].block[j]);
+            }
             free(processes[i].block);
         }
+        free(storeScratch);
         free(processes);
+        free(swapMap);
+        swapMap = NULL;
+        free(extents);
+        extents = NULL;
 
         // Free Semaphores
         assert(P1_SemFree(semSwap) == P1_SUCCESS);
         assert(P1_SemFree(semVMStats) == P1_SUCCESS);
+        assert(P1_SemFree(semIO) == P1_SUCCESS);
     }
     USLOSS_Console("Swap Shutdown End\n");
     return result;
@@ -248,19 +790,44 @@ P3SwapFreeAll(int pid)
         *****************/
         assert(P1_P(semSwap) == P1_SUCCESS);
         int i;
+        USLOSS_PTE *table;
+        assert(P3PageTableGet(pid, &table) == P1_SUCCESS);
+        // don't give away blocks that are still being written
         for(i = 0; i < num_pages; i++){
+            while (processes[pid].block[i].busy) {
+                WaitForIO();
+            }
+        }
+        // a shared frame stays with the processes still sharing it, and
+        // phase 3c tells us about the frames it frees on its own later
+        for(i = 0; table != NULL && policy->free != NULL && i < num_pages; i++){
+            PID owner;
+            int page, state;
+            if (table[i].incore &&
+                P3FrameInfo(table[i].frame, &owner, &page, &state) == P1_SUCCESS &&
+                state == P3_FRAME_MAPPED && owner == pid && page == i) {
+                policy->free(table[i].frame);
+            }
+        }
+        if (policy->quit != NULL) {
+            policy->quit(pid);
+        }
+        for(i = 0; i < num_pages; i++){
+            StoreDrop(&processes[pid].block[i]);
             if (processes[pid].block[i].track != -1 && processes[pid].block[i].sector != -1) {
-                Node *node = malloc(sizeof(Node));
-                node->block.isSwapped = FALSE;
-                node->block.sector = processes[pid].block[i].sector;
-                node->block.track = processes[pid].block[i].track;
-                node->next = freeBlocks;
-                freeBlocks = node;
+                SlotFree(BlockAddress(&processes[pid].block[i]) / sectors_per_page);
                 processes[pid].block[i].track = -1;
                 processes[pid].block[i].sector = -1;
                 processes[pid].block[i].isSwapped = FALSE;
+                processes[pid].block[i].valid = FALSE;
             }
         }
+        for (i = 0; i < extents_per_proc; i++) {
+            extents[pid * extents_per_proc + i] = -1;
+        }
+        // victims of the process that are being evicted are dropped
+        processes[pid].generation++;
+        processes[pid].quit = TRUE;
         assert(P1_V(semSwap) == P1_SUCCESS);
         
     }
@@ -273,12 +840,14 @@ P3SwapFreeAll(int pid)
  *
  * P3SwapOut --
  *
- * Uses the clock algorithm to select a frame to replace, writing the page that is in the frame out 
+ * Uses the replacement policy to select a frame to replace, writing the page that is in the frame out 
  * to swap if it is dirty. The page table of the page’s process is modified so that the page no 
  * longer maps to the frame. The frame that was selected is returned in *frame. 
+ * A page is given its swap block the first time it is written out.
  *
  * Results:
  *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P3_OUT_OF_SWAP:        the victim is dirty and the swap disk is full
  *   P1_SUCCESS:            success
  *
  *----------------------------------------------------------------------
@@ -312,49 +881,288 @@ P3SwapOut(int *frame)
     *frame = target
 
     *****************/
-   assert(P1_P(semSwap) == P1_SUCCESS);
-   USLOSS_Console("SwapOut Start\n");
-   if (!initialized) {
-       return P3_NOT_INITIALIZED;
-   }
-   static int hand = -1;
-   int access; int target;
-   while (TRUE) {
-       hand = (hand + 1) % num_frames;
-       USLOSS_Console("Looking at frame %d\n", hand);
-       assert(USLOSS_MmuGetAccess(hand, &access) == USLOSS_MMU_OK);
-       if (access != USLOSS_MMU_REF) {
-           target = hand;
-           break;
-       } else {
-           assert(USLOSS_MmuSetAccess(hand, 0) == USLOSS_MMU_OK);
-       }
-   }
-   int pid = frame_processes[target].pid;
-   int page = frame_processes[target].page;
-   // Writing to disk if the frame is dirty
-   if (access == USLOSS_MMU_DIRTY) {
-       USLOSS_Console("Swapping Dirty\n");
-       void *ptr;
-       assert(P3FrameMap(target, &ptr) == P1_SUCCESS);
-       int sector = processes[pid].block[page].sector;
-       int track = processes[pid].block[page].track;
-       USLOSS_Console("Writing for sector %d for track %d\n", sector, track);
-       assert(P2_DiskWrite(1, track, sector, sectors_per_page, ptr) == P1_SUCCESS);
-       assert(P3FrameUnmap(target) == P1_SUCCESS);
-   }
-    // setting incore to 0 for the page in the page table
+   int count;
+   return P3SwapOutBatch(1, frame, &count);
+}
+
+/*
+ * Returns TRUE if a frame holds nothing but zeros. The page is scanned a
+ * word at a time, a few words per test, so most non-zero pages are
+ * rejected within the first few words.
+ */
+static int
+FrameIsZero(int frame)
+{
+    void *ptr;
+    int pageSize = USLOSS_MmuPageSize();
+    int words = pageSize / sizeof(unsigned long);
+    const unsigned long *w;
+    int zero = TRUE;
+    int i;
+
+    assert(P3FrameMap(frame, &ptr) == P1_SUCCESS);
+    w = ptr;
+    for (i = 0; zero && i + 4 <= words; i += 4) {
+        zero = (w[i] | w[i + 1] | w[i + 2] | w[i + 3]) == 0;
+    }
+    for (; zero && i < words; i++) {
+        zero = w[i] == 0;
+    }
+    for (i = words * sizeof(unsigned long); zero && i < pageSize; i++) {
+        zero = ((char *) ptr)[i] == 0;
+    }
+    assert(P3FrameUnmap(frame) == P1_SUCCESS);
+    return zero;
+}
+
+/*
+ * Forgets a page's swap copy and returns its block, so the page is a
+ * demand-zero page again. Called with semSwap held.
+ */
+static void
+BlockDrop(Block *block)
+{
+    if (block->track != -1) {
+        SlotFree(BlockAddress(block) / sectors_per_page);
+        block->track = -1;
+        block->sector = -1;
+    }
+    StoreDrop(block);
+    block->isSwapped = FALSE;
+    block->valid = FALSE;
+}
+
+/*
+ * Tells whether a victim's process has quit since the policy chose it, or
+ * was already quitting then, so its page needs no swap copy and its block
+ * may belong to a new process with the same pid. Called with semSwap held.
+ */
+static int
+VictimGone(Victim *v)
+{
     USLOSS_PTE *table;
-    assert(P3PageTableGet(pid, &table) == P1_SUCCESS);
-    table[page].incore = 0;
-    table[page].read = 0;
-    table[page].write = 0;
-    USLOSS_Console("Setting table\n");
-    assert(USLOSS_MmuSetPageTable(table) == USLOSS_MMU_OK);
-    frame_processes[target].isBusy = TRUE;
+    assert(P3PageTableGet(v->pid, &table) == P1_SUCCESS);
+    return table == NULL || v->generation != processes[v->pid].generation;
+}
+
+/*
+ * Gives a victim's page back to its process because it can't be written
+ * out. If the process has quit there is nothing to give back to, and
+ * P3FrameKeep frees the frame instead. Called with semSwap held.
+ */
+static void
+VictimRestore(Victim *v)
+{
+    USLOSS_PTE *table;
+    if (!VictimGone(v)) {
+        assert(P3PageTableGet(v->pid, &table) == P1_SUCCESS);
+        table[v->page].incore = 1;
+        table[v->page].read = 1;
+        table[v->page].write = 1;
+        table[v->page].frame = v->frame;
+        assert(USLOSS_MmuSetPageTable(table) == USLOSS_MMU_OK);
+    }
+    if (VictimGone(v)) {
+        assert(P3FrameKeep(v->frame) == P1_SUCCESS);
+        if (policy->free != NULL) {
+            policy->free(v->frame);
+        }
+        return;
+    }
+    assert(P3FrameKeep(v->frame) == P1_SUCCESS);
+    IODone();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapOutBatch --
+ *
+ *  Replaces up to max frames in one pass of the replacement policy and
+ *  returns them in frames[0..*count-1]. Only the first victim is waited
+ *  for; the pass stops early when no other frame can be replaced. The
+ *  victims' page tables are updated and reloaded once per process, and
+ *  the dirty victims are written out with one P2_DiskWrite per run of
+ *  adjacent swap blocks.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P3_INVALID_FRAME:      max is invalid
+ *   P3_OUT_OF_SWAP:        every victim is dirty and the swap disk is full
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapOutBatch(int max, int *frames, int *count)
+{
+    Victim victims[P3_MAX_CLUSTER];
+    Victim *dirty[P3_MAX_CLUSTER];
+    int n, numDirty, i, j;
+
+    if (!initialized) {
+        return P3_NOT_INITIALIZED;
+    }
+    if (max < 1 || max > P3_MAX_CLUSTER) {
+        return P3_INVALID_FRAME;
+    }
+    assert(P1_P(semSwap) == P1_SUCCESS);
+    for (n = 0; n < max; n++) {
+        if (n > 0 && !AnyEvictable()) {
+            break;
+        }
+        Victim *v = &victims[n];
+        policy->select(&v->frame, &v->pid, &v->page, &v->access);
+        v->generation = processes[v->pid].quit ? -1 : processes[v->pid].generation;
+    }
+
+    // take the pages away from their processes so they can't change them
+    // while they are written out, reloading each page table once. The
+    // policy may have waited for I/O after choosing a victim, long enough
+    // for its process to quit.
+    for (i = 0; i < n; i++) {
+        USLOSS_PTE *table;
+        if (VictimGone(&victims[i])) {
+            continue;
+        }
+        assert(P3PageTableGet(victims[i].pid, &table) == P1_SUCCESS);
+        table[victims[i].page].incore = 0;
+        table[victims[i].page].read = 0;
+        table[victims[i].page].write = 0;
+        for (j = i + 1; j < n && (victims[j].pid != victims[i].pid || VictimGone(&victims[j])); j++) {
+            continue;
+        }
+        if (j == n) {
+            // last victim of this process
+            assert(USLOSS_MmuSetPageTable(table) == USLOSS_MMU_OK);
+        }
+    }
+
+    // sort the dirty victims by disk address so adjacent blocks form runs;
+    // the policy may have let the processes run since it sampled the bits.
+    // A page whose swap copy is still valid is simply dropped.
+    // An all-zero page needs no copy at all; any other dirty page goes in
+    // the compressed store if it fits, or else gets its swap block now and
+    // stays put if there is none.
+    numDirty = 0;
+    int numClean = 0;
+    int numZero = 0;
+    int numStored = 0;
+    int kept = 0;
+    for (i = 0; i < n; i++) {
+        int access;
+        Victim *v = &victims[i];
+        if (VictimGone(v)) {
+            // nothing to keep, the frame is simply free
+            victims[kept++] = *v;
+            continue;
+        }
+        assert(USLOSS_MmuGetAccess(v->frame, &access) == USLOSS_MMU_OK);
+        v->access |= access;
+        v->block = &processes[v->pid].block[v->page];
+        if (!(v->access & USLOSS_MMU_DIRTY) && !v->block->valid &&
+            (v->block->isSwapped || v->block->zdata != NULL)) {
+            v->access |= USLOSS_MMU_DIRTY;
+        }
+        if ((v->access & USLOSS_MMU_DIRTY) && FrameIsZero(v->frame)) {
+            // the next fault on the page zero-fills it again
+            BlockDrop(v->block);
+            v->access &= ~USLOSS_MMU_DIRTY;
+            numZero++;
+        }
+        if (v->access & USLOSS_MMU_DIRTY) {
+            // any compressed copy is out of date
+            StoreDrop(v->block);
+            if (StoreInsert(v->block, v->frame)) {
+                v->access &= ~USLOSS_MMU_DIRTY;
+                numStored++;
+            }
+        } else if (v->block->zdata != NULL) {
+            numClean++;
+            StoreStamp(v->block);
+        }
+        if ((v->access & USLOSS_MMU_DIRTY) && v->block->track == -1 &&
+            !BlockAssign(v->pid, v->page)) {
+            VictimRestore(v);
+            continue;
+        }
+        victims[kept] = *v;
+        v = &victims[kept++];
+        if (!(v->access & USLOSS_MMU_DIRTY)) {
+            numClean += v->block->isSwapped;
+            v->block->valid = FALSE;
+        } else {
+            v->block->busy = TRUE;
+            for (j = numDirty; j > 0 && BlockAddress(dirty[j - 1]->block) > BlockAddress(v->block); j--) {
+                dirty[j] = dirty[j - 1];
+            }
+            dirty[j] = v;
+            numDirty++;
+        }
+    }
+    n = kept;
+    if (n == 0) {
+        assert(P1_V(semSwap) == P1_SUCCESS);
+        return P3_OUT_OF_SWAP;
+    }
     assert(P1_V(semSwap) == P1_SUCCESS);
-    *frame = target;
-    USLOSS_Console("Swap Out End\n");
+
+    int pageSize = USLOSS_MmuPageSize();
+    int blockSize = sectors_per_page * sector_size;
+    char *buffer = NULL;
+    int start = 0;
+    while (start < numDirty) {
+        int run = 1;
+        while (start + run < numDirty &&
+               BlockAddress(dirty[start + run]->block) ==
+               BlockAddress(dirty[start]->block) + run * sectors_per_page) {
+            run++;
+        }
+        int first = BlockAddress(dirty[start]->block);
+        void *ptr;
+        if (run == 1) {
+            assert(P3FrameMap(dirty[start]->frame, &ptr) == P1_SUCCESS);
+            assert(P2_DiskWrite(1, dirty[start]->block->track, dirty[start]->block->sector,
+                                sectors_per_page, ptr) == P1_SUCCESS);
+            assert(P3FrameUnmap(dirty[start]->frame) == P1_SUCCESS);
+        } else {
+            if (buffer == NULL) {
+                buffer = calloc(numDirty, blockSize);
+            }
+            for (i = 0; i < run; i++) {
+                assert(P3FrameMap(dirty[start + i]->frame, &ptr) == P1_SUCCESS);
+                memcpy(buffer + i * blockSize, ptr, pageSize);
+                assert(P3FrameUnmap(dirty[start + i]->frame) == P1_SUCCESS);
+            }
+            debug3("Writing %d pages at sector %d\n", run, first);
+            assert(P2_DiskWrite(1, first / num_sectors, first % num_sectors,
+                                run * sectors_per_page, buffer) == P1_SUCCESS);
+        }
+        start += run;
+    }
+    free(buffer);
+
+    assert(P1_P(semSwap) == P1_SUCCESS);
+    for (i = 0; i < numDirty; i++) {
+        dirty[i]->block->busy = FALSE;
+        dirty[i]->block->isSwapped = TRUE;
+        dirty[i]->block->valid = FALSE;
+    }
+    if (numDirty > 0) {
+        IODone();
+    }
+    for (i = 0; i < n; i++) {
+        // the frame starts out clean and unreferenced for its next page
+        assert(USLOSS_MmuSetAccess(victims[i].frame, 0) == USLOSS_MMU_OK);
+        frames[i] = victims[i].frame;
+    }
+    assert(P1_V(semSwap) == P1_SUCCESS);
+    StatsAdd(&P3_vmStats.replaced, n);
+    StatsAdd(&P3_vmStats.pageOuts, numDirty);
+    StatsAdd(&P3_vmStats.cleanEvictions, numClean);
+    StatsAdd(&P3_vmStats.zeroPages, numZero);
+    StatsAdd(&P3_vmStats.compressed, numStored);
+    *count = n;
     return P1_SUCCESS;
 }
 /*
@@ -370,7 +1178,6 @@ P3SwapOut(int *frame)
  *   P1_INVALID_PAGE:        page is invalid         
  *   P1_INVALID_FRAME:       frame is invalid
  *   P3_EMPTY_PAGE:          page is not in swap
- *   P1_OUT_OF_SWAP:         there is no more swap space
  *   P1_SUCCESS:             success
  *
  *----------------------------------------------------------------------
@@ -385,11 +1192,7 @@ P3SwapIn(int pid, int page, int frame)
     if page is on swap disk
         read page from swap disk into frame (P3FrameMap,P2_DiskRead,P3FrameUnmap)
     else
-        allocate space for the page on the swap disk
-        if no more space
-            result = P3_OUT_OF_SWAP
-        else
-            result = P3_EMPTY_PAGE
+        result = P3_EMPTY_PAGE (P3SwapOut allocates its space)
     mark frame as not busy
     V(mutex)
 
@@ -411,38 +1214,1070 @@ P3SwapIn(int pid, int page, int frame)
 
    int ret = P1_SUCCESS;
     assert(P1_P(semSwap) == P1_SUCCESS);
-    if (processes[pid].block[page].track != -1 && processes[pid].block[page].sector != -1) {
+    // the page may still be on its way out to the swap disk
+    while (processes[pid].block[page].busy) {
+        WaitForIO();
+    }
+    // a new process may have the pid of one that quit
+    processes[pid].quit = FALSE;
+    if (processes[pid].block[page].zdata != NULL) {
+        // the copy stays in the store while the page is in memory, but
+        // can't be spilled
+        Block *block = &processes[pid].block[page];
+        void *ptr;
+        assert(P3FrameMap(frame, &ptr) == P1_SUCCESS);
+        Decompress((unsigned char *) block->zdata, block->zsize, ptr, USLOSS_MmuPageSize());
+        assert(P3FrameUnmap(frame) == P1_SUCCESS);
+        StoreUnstamp(block);
+        block->valid = TRUE;
+        StatsAdd(&P3_vmStats.decompressed, 1);
+    } else if (processes[pid].block[page].isSwapped) {
+        int track = processes[pid].block[page].track;
+        int sector = processes[pid].block[page].sector;
+        assert(P1_V(semSwap) == P1_SUCCESS);
+
         void *ptr;
         int pageSize = USLOSS_MmuPageSize();
         assert(P3FrameMap(frame, &ptr) == P1_SUCCESS);
-        USLOSS_Console("Reading for pid %d, track %d and sector %d\n", pid, processes[pid].block[page].track, processes[pid].block[page].sector);
-        char *addr = malloc(pageSize);
-        assert(P2_DiskRead(1, processes[pid].block[page].track, processes[pid].block[page].sector, sectors_per_page, addr) == P1_SUCCESS);
-        int i;
-        for (i=0; i<pageSize; i++) {
-            ((char *)ptr)[i] = addr[i];
+        USLOSS_Console("Reading for pid %d, track %d and sector %d\n", pid, track, sector);
+        if (sectors_per_page * sector_size == pageSize) {
+            // read straight into the frame
+            assert(P2_DiskRead(1, track, sector, sectors_per_page, ptr) == P1_SUCCESS);
+        } else {
+            // the last sector would run past the end of the frame
+            char *addr = malloc(sectors_per_page * sector_size);
+            assert(P2_DiskRead(1, track, sector, sectors_per_page, addr) == P1_SUCCESS);
+            memcpy(ptr, addr, pageSize);
+            free(addr);
         }
-        free(addr);
         assert(P3FrameUnmap(frame) == P1_SUCCESS);
         USLOSS_Console("Finished Reading\n");
-    } else {
-        Node *node = freeBlocks;
-        if (node == NULL) {
-            ret = P3_OUT_OF_SWAP;
+        StatsAdd(&P3_vmStats.pageIns, 1);
 
-        } else {
-            USLOSS_Console("Giving track %d and sector %d to %d\n", node->block.track, node->block.sector, pid);
-            processes[pid].block[page].track = node->block.track;
-            processes[pid].block[page].sector = node->block.sector;
-            freeBlocks = freeBlocks->next;
-            free(node);
-            ret = P3_EMPTY_PAGE;
-        }
+        assert(P1_P(semSwap) == P1_SUCCESS);
+        processes[pid].block[page].valid = TRUE;
+    } else {
+        // never written out, or all zeros when it was last evicted; its
+        // block is allocated when it is next evicted dirty
+        ret = P3_EMPTY_PAGE;
+    }
+    if (policy->faultIn != NULL) {
+        policy->faultIn(frame, pid, page);
     }
-    frame_processes[frame].isBusy = FALSE;
-    frame_processes[frame].pid = pid;
-    frame_processes[frame].page = page;
+    IODone();
     USLOSS_Console("SwapIn end\n");
     assert(P1_V(semSwap) == P1_SUCCESS);
     return ret;
-}
\ No newline at end of file
+}
+
+/*
+ * Returns the first sector of a block counting from track 0, sector 0.
+ */
+static int
+BlockAddress(Block *block)
+{
+    return block->track * num_sectors + block->sector;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapInCluster --
+ *
+ *  Reads several pages of a process into the given frames. Pages are
+ *  read in runs: consecutive entries of pages[] whose swap blocks are
+ *  adjacent on the disk (in either direction) are read with a single
+ *  P2_DiskRead. A page that has never been written to swap, or is being
+ *  written right now, is skipped; no swap space is allocated for it and
+ *  its frame is left untouched.
+ *
+ *  results[i] is set to P1_SUCCESS if pages[i] was read into frames[i]
+ *  and to P3_EMPTY_PAGE otherwise.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:     P3SwapInit has not been called
+ *   P1_INVALID_PID:         pid is invalid
+ *   P3_INVALID_PAGE:        count or a page is invalid
+ *   P3_INVALID_FRAME:       a frame is invalid
+ *   P1_SUCCESS:             success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapInCluster(PID pid, int count, int *pages, int *frames, int *results)
+{
+    int addrs[P3_MAX_CLUSTER];
+    int i;
+
+    if (!initialized) {
+        return P3_NOT_INITIALIZED;
+    }
+    if (pid < 0 || pid >= P1_MAXPROC) {
+        return P1_INVALID_PID;
+    }
+    if (count < 1 || count > P3_MAX_CLUSTER) {
+        return P3_INVALID_PAGE;
+    }
+    for (i = 0; i < count; i++) {
+        if (pages[i] < 0 || pages[i] >= num_pages) {
+            return P3_INVALID_PAGE;
+        }
+        if (frames[i] < 0 || frames[i] >= num_frames) {
+            return P3_INVALID_FRAME;
+        }
+    }
+
+    // pick the pages that have a copy on disk and mark their frames busy
+    assert(P1_P(semSwap) == P1_SUCCESS);
+    for (i = 0; i < count; i++) {
+        Block *block = &processes[pid].block[pages[i]];
+        if (block->isSwapped && !block->busy) {
+            results[i] = P1_SUCCESS;
+            addrs[i] = BlockAddress(block);
+        } else {
+            results[i] = P3_EMPTY_PAGE;
+        }
+    }
+    assert(P1_V(semSwap) == P1_SUCCESS);
+
+    int pageSize = USLOSS_MmuPageSize();
+    int blockSize = sectors_per_page * sector_size;
+    char *buffer = NULL;
+    int start = 0;
+    while (start < count) {
+        if (results[start] != P1_SUCCESS) {
+            start++;
+            continue;
+        }
+        // extend the run while the blocks stay adjacent in the same direction
+        int n = 1;
+        int dir = 0;
+        while (start + n < count && results[start + n] == P1_SUCCESS) {
+            int delta = addrs[start + n] - addrs[start + n - 1];
+            if (dir == 0 && (delta == sectors_per_page || delta == -sectors_per_page)) {
+                dir = delta;
+            }
+            if (delta != dir) {
+                break;
+            }
+            n++;
+        }
+        int first = (dir >= 0) ? addrs[start] : addrs[start + n - 1];
+        if (n == 1 && blockSize == pageSize) {
+            // a lone page is read straight into its frame
+            void *ptr;
+            assert(P3FrameMap(frames[start], &ptr) == P1_SUCCESS);
+            assert(P2_DiskRead(1, first / num_sectors, first % num_sectors,
+                               sectors_per_page, ptr) == P1_SUCCESS);
+            assert(P3FrameUnmap(frames[start]) == P1_SUCCESS);
+            StatsAdd(&P3_vmStats.pageIns, 1);
+            start++;
+            continue;
+        }
+        if (buffer == NULL) {
+            buffer = malloc(count * blockSize);
+        }
+        debug3("Reading %d pages of pid %d at sector %d\n", n, pid, first);
+        assert(P2_DiskRead(1, first / num_sectors, first % num_sectors,
+                           n * sectors_per_page, buffer) == P1_SUCCESS);
+        int k;
+        for (k = 0; k < n; k++) {
+            int slot = (dir >= 0) ? k : n - 1 - k;
+            void *ptr;
+            assert(P3FrameMap(frames[start + k], &ptr) == P1_SUCCESS);
+            memcpy(ptr, buffer + slot * blockSize, pageSize);
+            assert(P3FrameUnmap(frames[start + k]) == P1_SUCCESS);
+        }
+        StatsAdd(&P3_vmStats.pageIns, n);
+        start += n;
+    }
+    free(buffer);
+
+    assert(P1_P(semSwap) == P1_SUCCESS);
+    for (i = 0; i < count; i++) {
+        if (results[i] == P1_SUCCESS) {
+            processes[pid].block[pages[i]].valid = TRUE;
+            if (policy->faultIn != NULL) {
+                policy->faultIn(frames[i], pid, pages[i]);
+            }
+        }
+    }
+    IODone();
+    assert(P1_V(semSwap) == P1_SUCCESS);
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapQuery --
+ *
+ *  Tells whether a page has a copy on the swap disk, i.e. whether
+ *  P3SwapIn would have to read it.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:     P3SwapInit has not been called
+ *   P1_INVALID_PID:         pid is invalid
+ *   P3_INVALID_PAGE:        page is invalid
+ *   P3_EMPTY_PAGE:          page is not in swap
+ *   P1_SUCCESS:             page is in swap
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapQuery(PID pid, int page)
+{
+    if (!initialized) {
+        return P3_NOT_INITIALIZED;
+    }
+    if (pid < 0 || pid >= P1_MAXPROC) {
+        return P1_INVALID_PID;
+    }
+    if (page < 0 || page >= num_pages) {
+        return P3_INVALID_PAGE;
+    }
+    assert(P1_P(semSwap) == P1_SUCCESS);
+    Block *block = &processes[pid].block[page];
+    int result = (block->isSwapped || block->busy || block->zdata != NULL) ?
+                 P1_SUCCESS : P3_EMPTY_PAGE;
+    assert(P1_V(semSwap) == P1_SUCCESS);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapNotify --
+ *
+ *  Tells the swap system that a page was put in a frame without going
+ *  through P3SwapIn, as when a process is given its own copy of a merged
+ *  page, so the replacement policy starts tracking the frame for it.
+ *  The process is about to write the page, so any swap copy it has is
+ *  stale.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:     P3SwapInit has not been called
+ *   P1_INVALID_PID:         pid is invalid
+ *   P3_INVALID_PAGE:        page is invalid
+ *   P3_INVALID_FRAME:       frame is invalid
+ *   P1_SUCCESS:             success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapNotify(PID pid, int page, int frame)
+{
+    if (!initialized) {
+        return P3_NOT_INITIALIZED;
+    }
+    if (pid < 0 || pid >= P1_MAXPROC) {
+        return P1_INVALID_PID;
+    }
+    if (page < 0 || page >= num_pages) {
+        return P3_INVALID_PAGE;
+    }
+    if (frame < 0 || frame >= num_frames) {
+        return P3_INVALID_FRAME;
+    }
+    assert(P1_P(semSwap) == P1_SUCCESS);
+    processes[pid].block[page].valid = FALSE;
+    if (policy->faultIn != NULL) {
+        policy->faultIn(frame, pid, page);
+    }
+    assert(P1_V(semSwap) == P1_SUCCESS);
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapForget --
+ *
+ *  Tells the swap system that phase 3c freed a frame on its own, e.g.
+ *  one the merger emptied, so the replacement policy forgets the page
+ *  it held. Nothing happens if the frame has been handed out again.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:     P3SwapInit has not been called
+ *   P3_INVALID_FRAME:       frame is invalid
+ *   P1_SUCCESS:             success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapForget(int frame)
+{
+    if (!initialized) {
+        return P3_NOT_INITIALIZED;
+    }
+    if (frame < 0 || frame >= num_frames) {
+        return P3_INVALID_FRAME;
+    }
+    assert(P1_P(semSwap) == P1_SUCCESS);
+    PID pid;
+    int page, state;
+    assert(P3FrameInfo(frame, &pid, &page, &state) == P1_SUCCESS);
+    if (state == P3_FRAME_FREE && policy->free != NULL) {
+        policy->free(frame);
+    }
+    assert(P1_V(semSwap) == P1_SUCCESS);
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapWake --
+ *
+ *  Tells the swap system that a frame has been mapped, and so may be
+ *  replaced, so that pagers that found every frame busy look again.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:     P3SwapInit has not been called
+ *   P1_SUCCESS:             success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapWake(void)
+{
+    if (!initialized) {
+        return P3_NOT_INITIALIZED;
+    }
+    assert(P1_P(semSwap) == P1_SUCCESS);
+    IODone();
+    assert(P1_V(semSwap) == P1_SUCCESS);
+    return P1_SUCCESS;
+}
+
+/*
+ * Tells whether a frame may be chosen as a victim, i.e. it is mapped and
+ * not being written back, and returns its owner. Called with semSwap held.
+ */
+static int
+Evictable(int frame, PID *pid, int *page)
+{
+    int state;
+    assert(P3FrameInfo(frame, pid, page, &state) == P1_SUCCESS);
+    return state == P3_FRAME_MAPPED && !writeback[frame];
+}
+
+/*
+ * Tells whether any frame may be chosen as a victim. Called with semSwap held.
+ */
+static int
+AnyEvictable(void)
+{
+    PID pid;
+    int page;
+    int i;
+    for (i = 0; i < num_frames; i++) {
+        if (Evictable(i, &pid, &page)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Queues a dirty mapped frame for the writer. Called with semSwap held.
+ */
+static void
+ScheduleWriteback(int frame)
+{
+    if (!writeback[frame] && wbCount < num_frames) {
+        writeback[frame] = TRUE;
+        wbQueue[(wbHead + wbCount) % num_frames] = frame;
+        wbCount++;
+        assert(P1_V(semWriter) == P1_SUCCESS);
+    }
+}
+
+/*
+ * Moves the compressed copies of the pages that have been out of memory
+ * longest to their swap blocks until the store is down to STORE_LOW
+ * percent of its size. Called by the writer with semSwap held, which is
+ * released during each write.
+ */
+static void
+StoreSpill(void)
+{
+    int pageSize = USLOSS_MmuPageSize();
+    unsigned char *buffer = malloc(sectors_per_page * sector_size);
+
+    if (buffer == NULL) {
+        return;
+    }
+    while (storeBytes > storeLimit * STORE_LOW / 100) {
+        Block *block = storeOldest;
+        while (block != NULL && block->busy) {
+            block = block->newer;
+        }
+        if (block == NULL) {
+            break;
+        }
+        PID pid = block->pid;
+        int page = block->page;
+        if (block->track == -1 && !BlockAssign(pid, page)) {
+            break;
+        }
+        Decompress((unsigned char *) block->zdata, block->zsize, buffer, pageSize);
+        block->busy = TRUE;
+        assert(P1_V(semSwap) == P1_SUCCESS);
+
+        debug3("Spilling pid %d page %d\n", pid, page);
+        assert(P2_DiskWrite(1, block->track, block->sector, sectors_per_page,
+                            buffer) == P1_SUCCESS);
+        StatsAdd(&P3_vmStats.spilled, 1);
+
+        assert(P1_P(semSwap) == P1_SUCCESS);
+        block->busy = FALSE;
+        StoreDrop(block);
+        block->isSwapped = TRUE;
+        IODone();
+    }
+    free(buffer);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Writer --
+ *
+ *  The writeback daemon. Writes the pages in the frames queued by
+ *  ScheduleWriteback to their swap blocks while they stay mapped. The
+ *  dirty bit is cleared before the write, so a page modified while it
+ *  is being written stays dirty and is written again when evicted.
+ *  It also spills the compressed store when it fills up.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+Writer(void *arg)
+{
+    assert(P3FrameWindowCreate() == P1_SUCCESS);
+    //  notify P3SwapInit that we are running
+    assert(P1_V(semWriterDone) == P1_SUCCESS);
+    while (TRUE) {
+        assert(P1_P(semWriter) == P1_SUCCESS);
+        if (writerQuit) {
+            break;
+        }
+        assert(P1_P(semSwap) == P1_SUCCESS);
+        if (storeSpill) {
+            // this wakeup may have been for a queued frame, which the
+            // spill's own V will then take care of
+            StoreSpill();
+            storeSpill = FALSE;
+            assert(P1_V(semSwap) == P1_SUCCESS);
+            continue;
+        }
+        int frame = wbQueue[wbHead];
+        wbHead = (wbHead + 1) % num_frames;
+        wbCount--;
+
+        // the frame may have been freed or reused since it was queued
+        PID pid;
+        int page, state, access;
+        assert(P3FrameInfo(frame, &pid, &page, &state) == P1_SUCCESS);
+        assert(USLOSS_MmuGetAccess(frame, &access) == USLOSS_MMU_OK);
+        Block *block = NULL;
+        if (state == P3_FRAME_MAPPED) {
+            block = &processes[pid].block[page];
+            if (!(access & USLOSS_MMU_DIRTY) &&
+                (block->valid || !(block->isSwapped || block->zdata != NULL))) {
+                block = NULL;
+            }
+        }
+        if (block != NULL && block->track == -1 && !BlockAssign(pid, page)) {
+            block = NULL;
+        }
+        if (block != NULL && !block->busy) {
+            assert(USLOSS_MmuSetAccess(frame, access & ~USLOSS_MMU_DIRTY) == USLOSS_MMU_OK);
+            block->busy = TRUE;
+            // the disk copy replaces any compressed one
+            StoreDrop(block);
+            assert(P1_V(semSwap) == P1_SUCCESS);
+
+            // the page may have been merged into another process's frame
+            // since it was queued, taking its dirtiness along
+            void *ptr;
+            int written = FALSE;
+            if (P3FrameMap(frame, &ptr) == P1_SUCCESS) {
+                PID owner;
+                int ownerPage;
+                assert(P3FrameInfo(frame, &owner, &ownerPage, &state) == P1_SUCCESS);
+                if (owner == pid && ownerPage == page) {
+                    debug3("Writing back pid %d page %d from frame %d\n", pid, page, frame);
+                    assert(P2_DiskWrite(1, block->track, block->sector, sectors_per_page,
+                                        ptr) == P1_SUCCESS);
+                    StatsAdd(&P3_vmStats.writebacks, 1);
+                    written = TRUE;
+                }
+                assert(P3FrameUnmap(frame) == P1_SUCCESS);
+            }
+
+            assert(P1_P(semSwap) == P1_SUCCESS);
+            block->busy = FALSE;
+            if (written) {
+                block->isSwapped = TRUE;
+                // the copy is stale again if the page was written meanwhile
+                assert(USLOSS_MmuGetAccess(frame, &access) == USLOSS_MMU_OK);
+                block->valid = !(access & USLOSS_MMU_DIRTY);
+            } else {
+                PID owner;
+                int ownerPage;
+                assert(P3FrameInfo(frame, &owner, &ownerPage, &state) == P1_SUCCESS);
+                if (owner == pid && ownerPage == page) {
+                    // still ours after all, so it still needs writing
+                    assert(USLOSS_MmuGetAccess(frame, &access) == USLOSS_MMU_OK);
+                    assert(USLOSS_MmuSetAccess(frame, access | USLOSS_MMU_DIRTY) == USLOSS_MMU_OK);
+                }
+                block->valid = FALSE;
+            }
+        }
+        writeback[frame] = FALSE;
+        IODone();
+        assert(P1_V(semSwap) == P1_SUCCESS);
+    }
+    assert(P3FrameWindowDestroy() == P1_SUCCESS);
+    assert(P1_V(semWriterDone) == P1_SUCCESS);
+    return 0;
+}
+
+/*
+ * Reads a mapped frame's access bits and passes them to the policy's
+ * reference hook. A dirty page no longer matches its swap copy. Called
+ * with semSwap held.
+ */
+static int
+SampleAccess(int frame)
+{
+    int access;
+    assert(USLOSS_MmuGetAccess(frame, &access) == USLOSS_MMU_OK);
+    StatsAdd(&P3_vmStats.scanned, 1);
+    if (access & USLOSS_MMU_DIRTY) {
+        PID pid;
+        int page, state;
+        assert(P3FrameInfo(frame, &pid, &page, &state) == P1_SUCCESS);
+        if (state != P3_FRAME_FREE && pid != -1 && page != -1) {
+            processes[pid].block[page].valid = FALSE;
+        }
+    }
+    if (policy->reference != NULL) {
+        policy->reference(frame, access);
+    }
+    return access;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * The clock policy --
+ *
+ *  Second chance. The hand sweeps the frames, skipping busy ones; a
+ *  referenced frame has its reference bit cleared and is passed over,
+ *  the first unreferenced frame is the victim.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int clockHand;
+
+static void
+ClockInit(int frames)
+{
+    clockHand = -1;     // start with frame 0
+}
+
+static void
+ClockSelect(int *frame, PID *pid, int *page, int *access)
+{
+    int busy = 0;
+    while (TRUE) {
+        clockHand = (clockHand + 1) % num_frames;
+        debug3("Looking at frame %d\n", clockHand);
+        if (!Evictable(clockHand, pid, page)) {
+            // every frame is being read or written, wait for one to finish
+            if (++busy == num_frames) {
+                WaitForIO();
+                busy = 0;
+            }
+            continue;
+        }
+        busy = 0;
+        *access = SampleAccess(clockHand);
+        if (*access & USLOSS_MMU_REF) {
+            // keep the dirty bit, the page still has to be written out
+            assert(USLOSS_MmuSetAccess(clockHand, *access & ~USLOSS_MMU_REF) == USLOSS_MMU_OK);
+            StatsAdd(&P3_vmStats.secondChances, 1);
+        } else if (P3FrameEvict(clockHand, pid, page) == P1_SUCCESS) {
+            // the reverse map marks the frame busy and tells us whose it is
+            *frame = clockHand;
+            return;
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * The NRU policy --
+ *
+ *  Enhanced second chance. Frames are classed by their (referenced,
+ *  dirty) bits and the victim is taken from the cheapest class. The
+ *  hand sweeps the frames in rounds: even rounds take the first clean
+ *  unreferenced frame and schedule the dirty unreferenced ones for
+ *  writeback, so they are clean by the time the hand comes back; odd
+ *  rounds also accept a dirty unreferenced frame and clear reference
+ *  bits as they go.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int nruHand;
+
+static void
+NruInit(int frames)
+{
+    nruHand = -1;
+}
+
+static void
+NruSelect(int *frame, PID *pid, int *page, int *access)
+{
+    int round;
+    for (round = 0; ; round++) {
+        int candidates = 0;
+        int i;
+        for (i = 0; i < num_frames; i++) {
+            nruHand = (nruHand + 1) % num_frames;
+            if (!Evictable(nruHand, pid, page)) {
+                continue;
+            }
+            candidates++;
+            *access = SampleAccess(nruHand);
+            if (*access & USLOSS_MMU_REF) {
+                if (round % 2 == 1) {
+                    assert(USLOSS_MmuSetAccess(nruHand, *access & ~USLOSS_MMU_REF) == USLOSS_MMU_OK);
+                    StatsAdd(&P3_vmStats.secondChances, 1);
+                }
+            } else if (!(*access & USLOSS_MMU_DIRTY) || round % 2 == 1) {
+                if (P3FrameEvict(nruHand, pid, page) == P1_SUCCESS) {
+                    *frame = nruHand;
+                    return;
+                }
+            } else {
+                ScheduleWriteback(nruHand);
+            }
+        }
+        if (candidates == 0) {
+            // every frame is busy or being written back, wait for one
+            WaitForIO();
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * The WSClock policy --
+ *
+ *  Working-set clock. Each frame records the virtual time (CPU time)
+ *  of its owner when the page was last seen referenced. The hand
+ *  passes over referenced frames, stamping them, and over frames still
+ *  in their owner's working set; the first clean frame older than the
+ *  window is the victim and old dirty frames are scheduled for
+ *  writeback. If a sweep finds nothing, the hand waits for scheduled
+ *  writes to finish, or takes the oldest frame if none were scheduled.
+ *
+ *----------------------------------------------------------------------
+ */
+
+#define WSCLOCK_WAITS 2     // sweeps that may wait for writeback before giving up
+
+static int wsHand;
+static int wsWindow;
+static int *wsLastUse;
+
+/*
+ * Returns the CPU time used by a process, in microseconds.
+ */
+static int
+VirtualTime(PID pid)
+{
+    P1_ProcInfo info;
+    if (P1_GetProcInfo(pid, &info) != P1_SUCCESS) {
+        return -1;
+    }
+    return info.cpu;
+}
+
+static void
+WsInit(int frames)
+{
+    wsHand = -1;
+    assert(P3WorkingSetGet(&wsWindow) == P1_SUCCESS);
+    wsLastUse = malloc(frames * sizeof(int));
+    int i;
+    for (i = 0; i < frames; i++) {
+        wsLastUse[i] = 0;
+    }
+}
+
+static void
+WsDone(void)
+{
+    free(wsLastUse);
+    wsLastUse = NULL;
+}
+
+static void
+WsFaultIn(int frame, PID pid, int page)
+{
+    int now = VirtualTime(pid);
+    wsLastUse[frame] = (now == -1) ? 0 : now;
+}
+
+static void
+WsSelect(int *frame, PID *pid, int *page, int *access)
+{
+    int round;
+    for (round = 0; ; round++) {
+        int candidates = 0;
+        int scheduled = 0;
+        int oldest = -1;
+        int oldestAge = -1;
+        int i;
+        for (i = 0; i < num_frames; i++) {
+            wsHand = (wsHand + 1) % num_frames;
+            if (!Evictable(wsHand, pid, page)) {
+                continue;
+            }
+            candidates++;
+            *access = SampleAccess(wsHand);
+            int now = VirtualTime(*pid);
+            if (*access & USLOSS_MMU_REF) {
+                wsLastUse[wsHand] = now;
+                assert(USLOSS_MmuSetAccess(wsHand, *access & ~USLOSS_MMU_REF) == USLOSS_MMU_OK);
+                StatsAdd(&P3_vmStats.secondChances, 1);
+                continue;
+            }
+            // a process that is gone has no working set
+            int age = (now == -1) ? wsWindow + 1 : now - wsLastUse[wsHand];
+            if (age > oldestAge) {
+                oldest = wsHand;
+                oldestAge = age;
+            }
+            if (age <= wsWindow) {
+                continue;
+            }
+            if (!(*access & USLOSS_MMU_DIRTY)) {
+                if (P3FrameEvict(wsHand, pid, page) == P1_SUCCESS) {
+                    StatsAdd(&P3_vmStats.outsideWorkingSet, 1);
+                    *frame = wsHand;
+                    return;
+                }
+            } else {
+                ScheduleWriteback(wsHand);
+                scheduled++;
+            }
+        }
+        if (candidates == 0 || (scheduled > 0 && round < WSCLOCK_WAITS)) {
+            // wait for a frame to be freed up or cleaned
+            WaitForIO();
+            continue;
+        }
+        if (oldest != -1 && Evictable(oldest, pid, page) &&
+            P3FrameEvict(oldest, pid, page) == P1_SUCCESS) {
+            assert(USLOSS_MmuGetAccess(oldest, access) == USLOSS_MMU_OK);
+            if (oldestAge > wsWindow) {
+                StatsAdd(&P3_vmStats.outsideWorkingSet, 1);
+            }
+            *frame = oldest;
+            return;
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * The CLOCK-Pro policy --
+ *
+ *  Scan resistant. A page faulted in is cold; it becomes hot if it is
+ *  referenced again while resident, or if it faults again while it is
+ *  still a ghost, i.e. within the last # of frames evictions. Only cold
+ *  pages are evicted. The hand clears the reference bits of hot pages
+ *  and demotes unreferenced hot pages to cold when there are too many
+ *  hot pages or a sweep finds no cold victim. A process sweeping
+ *  through its pages only ever has cold pages, so it replaces its own
+ *  pages rather than other processes' hot ones.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int proHand;
+static int proHotMax;       // most frames that may hold hot pages
+static int proHotCount;
+static int *proHot;         // frame holds a hot page
+static int *proGhost;       // eviction # (from 1) of each (pid, page), 0 if none
+static int proEvictions;
+
+#define ProGhost(pid, page) proGhost[(pid) * num_pages + (page)]
+
+static void
+ProInit(int frames)
+{
+    proHand = -1;
+    proHotCount = 0;
+    proEvictions = 0;
+    // leave at least a quarter of memory for cold pages
+    proHotMax = frames - (frames / 4 > 0 ? frames / 4 : 1);
+    proHot = malloc(frames * sizeof(int));
+    int i;
+    for (i = 0; i < frames; i++) {
+        proHot[i] = FALSE;
+    }
+    proGhost = malloc(P1_MAXPROC * num_pages * sizeof(int));
+    for (i = 0; i < P1_MAXPROC * num_pages; i++) {
+        proGhost[i] = 0;
+    }
+}
+
+static void
+ProDone(void)
+{
+    free(proHot);
+    proHot = NULL;
+    free(proGhost);
+    proGhost = NULL;
+}
+
+static void
+ProFaultIn(int frame, PID pid, int page)
+{
+    int evicted = ProGhost(pid, page);
+    ProGhost(pid, page) = 0;
+    int hot = (evicted != 0 && proEvictions - evicted < num_frames);
+    // the frame may still be marked for a page that left it unnoticed
+    proHotCount += hot - proHot[frame];
+    proHot[frame] = hot;
+    if (hot) {
+        StatsAdd(&P3_vmStats.ghostHits, 1);
+    }
+}
+
+static void
+ProFree(int frame)
+{
+    if (proHot[frame]) {
+        proHot[frame] = FALSE;
+        proHotCount--;
+    }
+}
+
+// A process that reuses the pid must not inherit the ghosts.
+static void
+ProQuit(PID pid)
+{
+    int page;
+    for (page = 0; page < num_pages; page++) {
+        ProGhost(pid, page) = 0;
+    }
+}
+
+static void
+ProSelect(int *frame, PID *pid, int *page, int *access)
+{
+    int round;
+    for (round = 0; ; round++) {
+        int candidates = 0;
+        int i;
+        for (i = 0; i < num_frames; i++) {
+            proHand = (proHand + 1) % num_frames;
+            if (!Evictable(proHand, pid, page)) {
+                continue;
+            }
+            candidates++;
+            *access = SampleAccess(proHand);
+            if (*access & USLOSS_MMU_REF) {
+                // a referenced cold page has been used twice, make it hot
+                if (!proHot[proHand]) {
+                    proHot[proHand] = TRUE;
+                    proHotCount++;
+                }
+                assert(USLOSS_MmuSetAccess(proHand, *access & ~USLOSS_MMU_REF) == USLOSS_MMU_OK);
+                StatsAdd(&P3_vmStats.secondChances, 1);
+            } else if (proHot[proHand]) {
+                if (round > 0 || proHotCount > proHotMax) {
+                    proHot[proHand] = FALSE;
+                    proHotCount--;
+                }
+            } else if (P3FrameEvict(proHand, pid, page) == P1_SUCCESS) {
+                proEvictions++;
+                ProGhost(*pid, *page) = proEvictions;
+                *frame = proHand;
+                return;
+            }
+        }
+        if (candidates == 0) {
+            // every frame is busy or being written back, wait for one
+            WaitForIO();
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * The aging policy --
+ *
+ *  Approximate LRU. Each frame has an 8-bit age. A low-priority scanner
+ *  wakes every AGING_PERIOD seconds, samples and clears the reference
+ *  bit of every mapped frame and shifts it into the frame's age. The
+ *  victim is the frame with the smallest age, clean frames winning
+ *  ties. Only the scanner changes the ages: eviction reads the access
+ *  bits straight from the MMU and ranks each frame by the age the next
+ *  scan would give it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+#define AGING_PERIOD    1       // seconds between scans
+#define AGING_PRIORITY  5
+#define AGING_TOP       0x80    // bit set in the age when the frame was referenced
+
+static int *agingAge;
+static int agingQuit;
+static SID agingDone;       // V'd by the scanner when it starts and when it exits
+static int AgingScanner(void *arg);
+
+static void
+AgingInit(int frames)
+{
+    agingAge = malloc(frames * sizeof(int));
+    int i;
+    for (i = 0; i < frames; i++) {
+        agingAge[i] = 0;
+    }
+    agingQuit = FALSE;
+    char name[P1_MAXNAME + 1];
+    strcpy(name, "aging_done");
+    assert(P1_SemCreate(name, 0, &agingDone) == P1_SUCCESS);
+    strcpy(name, "aging");
+    int pid;
+    assert(P1_Fork(name, AgingScanner, NULL, USLOSS_MIN_STACK, AGING_PRIORITY, 1,
+                   &pid) == P1_SUCCESS);
+    assert(P1_P(agingDone) == P1_SUCCESS);
+}
+
+static void
+AgingDone(void)
+{
+    // the scanner notices when it wakes up, it must not touch the ages after this
+    agingQuit = TRUE;
+    assert(P1_V(semSwap) == P1_SUCCESS);
+    assert(P1_P(agingDone) == P1_SUCCESS);
+    assert(P1_P(semSwap) == P1_SUCCESS);
+    assert(P1_SemFree(agingDone) == P1_SUCCESS);
+    free(agingAge);
+    agingAge = NULL;
+}
+
+static void
+AgingFaultIn(int frame, PID pid, int page)
+{
+    agingAge[frame] = AGING_TOP;
+}
+
+static void
+AgingReference(int frame, int access)
+{
+    agingAge[frame] = (agingAge[frame] >> 1) | ((access & USLOSS_MMU_REF) ? AGING_TOP : 0);
+}
+
+static void
+AgingFree(int frame)
+{
+    agingAge[frame] = 0;
+}
+
+static void
+AgingSelect(int *frame, PID *pid, int *page, int *access)
+{
+    while (TRUE) {
+        int best = -1;
+        int bestAge = 0;
+        int bestAccess = 0;
+        int i;
+        for (i = 0; i < num_frames; i++) {
+            if (!Evictable(i, pid, page)) {
+                continue;
+            }
+            int bits;
+            assert(USLOSS_MmuGetAccess(i, &bits) == USLOSS_MMU_OK);
+            int age = (agingAge[i] >> 1) | ((bits & USLOSS_MMU_REF) ? AGING_TOP : 0);
+            // prefer a clean frame on a tie, it doesn't have to be written out
+            if (best == -1 || age < bestAge ||
+                (age == bestAge && (bestAccess & USLOSS_MMU_DIRTY) &&
+                 !(bits & USLOSS_MMU_DIRTY))) {
+                best = i;
+                bestAge = age;
+                bestAccess = bits;
+            }
+        }
+        if (best == -1) {
+            // every frame is busy or being written back, wait for one
+            WaitForIO();
+            continue;
+        }
+        StatsAdd(&P3_vmStats.scanned, 1);
+        if (P3FrameEvict(best, pid, page) == P1_SUCCESS) {
+            *frame = best;
+            *access = bestAccess;
+            return;
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AgingScanner --
+ *
+ *  The aging daemon. Every AGING_PERIOD seconds it samples and clears
+ *  the reference bits of all mapped frames, which ages them.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+AgingScanner(void *arg)
+{
+    //  notify AgingInit that we are running
+    assert(P1_V(agingDone) == P1_SUCCESS);
+    while (TRUE) {
+        assert(P2_Sleep(AGING_PERIOD) == P1_SUCCESS);
+        if (agingQuit) {
+            break;
+        }
+        assert(P1_P(semSwap) == P1_SUCCESS);
+        int i;
+        for (i = 0; i < num_frames; i++) {
+            PID pid;
+            int page, state, access;
+            assert(P3FrameInfo(i, &pid, &page, &state) == P1_SUCCESS);
+            if (state != P3_FRAME_MAPPED) {
+                continue;
+            }
+            access = SampleAccess(i);
+            if (access & USLOSS_MMU_REF) {
+                assert(USLOSS_MmuSetAccess(i, access & ~USLOSS_MMU_REF) == USLOSS_MMU_OK);
+            }
+        }
+        StatsAdd(&P3_vmStats.agingScans, 1);
+        assert(P1_V(semSwap) == P1_SUCCESS);
+    }
+    assert(P1_V(agingDone) == P1_SUCCESS);
+    return 0;
+}
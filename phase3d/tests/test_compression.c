@@ -0,0 +1,189 @@
+/*
+ * test_compression.c
+ *
+ *  Compressed page store test case for Phase 3 Part D. It runs the VM system three
+ *  times, each time with two processes, "A" and "B", with eight pages each on four
+ *  frames. Each process fills each of its pages, sleeps for one second, then verifies
+ *  the pages.
+ *
+ *      - With the store off, which is the default, and pages that compress well, no page
+ *        goes into the store.
+ *      - With the store on and pages of noise, which don't compress, no page goes into
+ *        the store and they are all written to disk.
+ *      - With the store on and pages filled with a short repeating pattern made from the
+ *        process's name and the page number, pages go into the store and come back out
+ *        of it. The store is a single frame's worth, so it fills up quickly and pages
+ *        have to be spilled to disk.
+ *
+ *  It also checks that P3_VmSetCompression rejects sizes that are not a percentage.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <libdisk.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 8         // # of pages per process
+#define FRAMES 4
+#define COMPRESSION 25  // % of the frames given to the store, i.e. one frame
+#define ITERATIONS 4
+#define PAGERS 2        // # of pagers
+
+static char *vmRegion;
+static char *names[] = {"A","B"};
+static int  numChildren = sizeof(names) / sizeof(char *);
+static int  pageSize;
+static int  noise;      // fill the pages with noise rather than a pattern
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+static int debugging = 1;
+#else
+static int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+// Byte k of page j of process name. The pattern repeats every seven bytes;
+// the noise is a hash of name, j and k.
+static char
+Fill(volatile char *name, int j, int k)
+{
+    if (noise) {
+        unsigned int x = (*name << 24) + j * pageSize + k;
+        x ^= x >> 16;
+        x *= 0x7feb352d;
+        x ^= x >> 15;
+        x *= 0x846ca68b;
+        x ^= x >> 16;
+        return (char) x;
+    }
+    return *name + j + (k % 7 == 0);
+}
+
+static int
+Child(void *arg)
+{
+    volatile char *name = (char *) arg;
+    int     i,j;
+    char    *page;
+    int     rc;
+    int     pid;
+
+    Sys_GetPID(&pid);
+    Debug("Child \"%s\" (%d) starting.\n", name, pid);
+    for (i = 0; i < ITERATIONS; i++) {
+        for (j = 0; j < PAGES; j++) {
+            page = vmRegion + j * pageSize;
+            Debug("Child \"%s\" (%d) writing to page %d @ %p\n", name, pid, j, page);
+            for (int k = 0; k < pageSize; k++) {
+                page[k] = Fill(name, j, k);
+            }
+        }
+        rc = Sys_Sleep(1);
+        assert(rc == P1_SUCCESS);
+        for (j = 0; j < PAGES; j++) {
+            page = vmRegion + j * pageSize;
+            Debug("Child \"%s\" (%d) reading from page %d @ %p\n", name, pid, j, page);
+            for (int k = 0; k < pageSize; k++) {
+                TEST(page[k], Fill(name, j, k));
+            }
+        }
+    }
+    Debug("Child \"%s\" (%d) done.\n", name, pid);
+    return 0;
+}
+
+
+static void
+Run(void)
+{
+    int     i;
+    int     rc;
+    int     pid;
+    int     status;
+
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    pageSize = USLOSS_MmuPageSize();
+    for (i = 0; i < numChildren; i++) {
+        rc = Sys_Spawn(names[i], Child, (void *) names[i], USLOSS_MIN_STACK * 4, 3, &pid);
+        assert(rc == P1_SUCCESS);
+    }
+    for (i = 0; i < numChildren; i++) {
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+    }
+    Debug("Children terminated\n");
+}
+
+
+int
+P4_Startup(void *arg)
+{
+    int     rc;
+
+    Debug("P4_Startup starting.\n");
+    rc = P3_VmSetCompression(-1);
+    TEST(rc, P3_INVALID_ARGUMENT);
+    rc = P3_VmSetCompression(101);
+    TEST(rc, P3_INVALID_ARGUMENT);
+
+    // the store is off by default
+    noise = FALSE;
+    Run();
+    TEST(P3_vmStats.pageOuts > 0, TRUE);
+    TEST(P3_vmStats.compressed, 0);
+    Sys_VmShutdown();
+
+    rc = P3_VmSetCompression(COMPRESSION);
+    TEST(rc, P1_SUCCESS);
+    noise = TRUE;
+    Run();
+    TEST(P3_vmStats.pageOuts > 0, TRUE);
+    TEST(P3_vmStats.compressed, 0);
+    TEST(P3_vmStats.decompressed, 0);
+    Sys_VmShutdown();
+
+    noise = FALSE;
+    Run();
+    TEST(P3_vmStats.compressed > 0, TRUE);
+    TEST(P3_vmStats.decompressed > 0, TRUE);
+    TEST(P3_vmStats.spilled > 0, TRUE);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+    DeleteAllDisks();
+    int rc = Disk_Create(NULL, P3_SWAP_DISK, numChildren * PAGES);
+    assert(rc == 0);
+}
+
+void test_cleanup(int argc, char **argv) {
+    DeleteAllDisks();
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
@@ -0,0 +1,173 @@
+/*
+ * test_merge.c
+ *
+ *  Page merging test case for Phase 3 Part D. It turns on merging with P3_VmSetMerging
+ *  and runs two processes, "A" and "B", whose pages all fit in memory. Each process
+ *  fills each of its pages but the last with the same contents as the other process,
+ *  and its last page with its own name, then sleeps long enough for the merger to run.
+ *
+ *  While they sleep it checks their page tables: every page but the last must share a
+ *  read-only frame with the same page of the other process, and the last pages must not
+ *  be merged. The processes then check the pages, write their name plus the page number
+ *  into each of them, and check them again. Once the children are done it checks that
+ *  the writes gave the processes copies of their own.
+ *
+ *  It also checks that P3_VmSetMerging rejects a negative interval.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <libdisk.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 4         // # of pages per process
+#define FRAMES 8        // all of the pages fit
+#define INTERVAL 1      // the merger runs every INTERVAL seconds
+#define PAGERS 2        // # of pagers
+#define UNIQUE (PAGES - 1)  // page that differs between the processes
+
+static char *vmRegion;
+static char *names[] = {"A","B"};
+static int  numChildren = sizeof(names) / sizeof(char *);
+static int  pageSize;
+static int  pids[2];    // of the children
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+static int debugging = 1;
+#else
+static int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+
+static int
+Child(void *arg)
+{
+    volatile char *name = (char *) arg;
+    int     j;
+    char    *page;
+    int     rc;
+    int     pid;
+
+    Sys_GetPID(&pid);
+    Debug("Child \"%s\" (%d) starting.\n", name, pid);
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child \"%s\" (%d) filling page %d @ %p\n", name, pid, j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = j == UNIQUE ? *name : 'M' + j;
+        }
+    }
+    // give the merger time to merge the pages, and P4_Startup time to look
+    rc = Sys_Sleep(4 * INTERVAL);
+    assert(rc == P1_SUCCESS);
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child \"%s\" (%d) writing to page %d @ %p\n", name, pid, j, page);
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], j == UNIQUE ? *name : 'M' + j);
+        }
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = *name + j;
+        }
+    }
+    rc = Sys_Sleep(1);
+    assert(rc == P1_SUCCESS);
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child \"%s\" (%d) reading from page %d @ %p\n", name, pid, j, page);
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], *name + j);
+        }
+    }
+    Debug("Child \"%s\" (%d) done.\n", name, pid);
+    return 0;
+}
+
+
+int
+P4_Startup(void *arg)
+{
+    int     i;
+    int     rc;
+    int     pid;
+    int     status;
+    USLOSS_PTE *tables[2];
+
+    Debug("P4_Startup starting.\n");
+    rc = P3_VmSetMerging(-1);
+    TEST(rc, P3_INVALID_ARGUMENT);
+    rc = P3_VmSetMerging(INTERVAL);
+    TEST(rc, P1_SUCCESS);
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+
+    pageSize = USLOSS_MmuPageSize();
+    for (i = 0; i < numChildren; i++) {
+        rc = Sys_Spawn(names[i], Child, (void *) names[i], USLOSS_MIN_STACK * 4, 3, &pids[i]);
+        assert(rc == P1_SUCCESS);
+    }
+    // the children are asleep, and the merger has run since they filled their pages
+    rc = Sys_Sleep(3 * INTERVAL);
+    assert(rc == P1_SUCCESS);
+    for (i = 0; i < numChildren; i++) {
+        rc = P3PageTableGet(pids[i], &tables[i]);
+        assert(rc == P1_SUCCESS);
+    }
+    for (i = 0; i < PAGES; i++) {
+        TEST(tables[0][i].incore, 1);
+        TEST(tables[1][i].incore, 1);
+        if (i == UNIQUE) {
+            TEST(tables[0][i].frame != tables[1][i].frame, TRUE);
+        } else {
+            TEST(tables[0][i].frame, tables[1][i].frame);
+            TEST(tables[0][i].write, 0);
+            TEST(tables[1][i].write, 0);
+        }
+    }
+    TEST(P3_vmStats.merged, PAGES - 1);
+    for (i = 0; i < numChildren; i++) {
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+    }
+    Debug("Children terminated\n");
+    TEST(P3_vmStats.cowFaults >= PAGES - 1, TRUE);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+    DeleteAllDisks();
+    int rc = Disk_Create(NULL, P3_SWAP_DISK, numChildren * PAGES);
+    assert(rc == 0);
+}
+
+void test_cleanup(int argc, char **argv) {
+    DeleteAllDisks();
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
@@ -0,0 +1,258 @@
+/*
+ * test_policy.c
+ *
+ *  Replacement policy test case for Phase 3 Part D. It runs every policy in turn, with
+ *  a P3_VmSetPolicy, Sys_VmInit and Sys_VmShutdown for each.
+ *
+ *  First three processes, "A", "B" and "C", whose pages don't all fit in memory, write
+ *  their name plus the page number into each of their pages, sleep for one second, then
+ *  verify the pages, re-reading their first page between writes so that the policy sees
+ *  some pages referenced more than others. Once they are done it checks that the policy
+ *  replaced pages and wrote them out.
+ *
+ *  Then a single process, "P", fills memory and looks at its page table to see which of
+ *  its pages the policy chose when it touches one more page:
+ *
+ *      NRU         the one page that was only read, i.e. the only clean one.
+ *      CLOCK-Pro   faulting the evicted page straight back in is a ghost hit.
+ *      aging       the page that wasn't referenced while the aging daemon ran.
+ *
+ *  It also checks that P3_VmSetPolicy rejects policies that don't exist.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <libdisk.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 6         // # of pages per process
+#define FRAMES 4        // P needs more than FRAMES pages
+#define ITERATIONS 3
+#define PAGERS 2        // # of pagers
+#define OLD 1           // page P leaves alone while the aging daemon runs
+
+static char *vmRegion;
+static char *names[] = {"A","B","C"};
+static int  numChildren = sizeof(names) / sizeof(char *);
+static int  pageSize;
+static int  policy;     // policy being tested
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+static int debugging = 1;
+#else
+static int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+
+static int
+Child(void *arg)
+{
+    volatile char *name = (char *) arg;
+    int     i,j;
+    char    *page;
+    int     rc;
+    int     pid;
+
+    Sys_GetPID(&pid);
+    Debug("Child \"%s\" (%d) starting.\n", name, pid);
+    for (i = 0; i < ITERATIONS; i++) {
+        for (j = 0; j < PAGES; j++) {
+            page = vmRegion + j * pageSize;
+            Debug("Child \"%s\" (%d) writing to page %d @ %p\n", name, pid, j, page);
+            for (int k = 0; k < pageSize; k++) {
+                page[k] = *name + j;
+            }
+            // keep the first page busy
+            TEST(vmRegion[0], *name);
+        }
+        rc = Sys_Sleep(1);
+        assert(rc == P1_SUCCESS);
+        for (j = 0; j < PAGES; j++) {
+            page = vmRegion + j * pageSize;
+            Debug("Child \"%s\" (%d) reading from page %d @ %p\n", name, pid, j, page);
+            for (int k = 0; k < pageSize; k++) {
+                TEST(page[k], *name + j);
+            }
+        }
+    }
+    Debug("Child \"%s\" (%d) done.\n", name, pid);
+    return 0;
+}
+
+// Returns TRUE if page of process pid is in memory.
+static int
+Resident(int pid, int page)
+{
+    USLOSS_PTE  *table;
+
+    assert(P3PageTableGet(pid, &table) == P1_SUCCESS);
+    return table[page].incore;
+}
+
+static void
+Write(int page, char c)
+{
+    for (int k = 0; k < pageSize; k++) {
+        vmRegion[page * pageSize + k] = c;
+    }
+}
+
+static void
+Read(int page, char c)
+{
+    for (int k = 0; k < pageSize; k++) {
+        TEST(vmRegion[page * pageSize + k], c);
+    }
+}
+
+static int
+Probe(void *arg)
+{
+    int     i,j;
+    int     rc;
+    int     pid;
+
+    Sys_GetPID(&pid);
+    Debug("Probe (%d) starting, policy %d.\n", pid, policy);
+    switch (policy) {
+        case P3_POLICY_NRU:
+            // every page but the last one is dirty
+            for (j = 0; j < FRAMES - 1; j++) {
+                Write(j, 'P' + j);
+            }
+            Read(FRAMES - 1, 0);
+            Write(FRAMES, 'P' + FRAMES);
+            TEST(Resident(pid, FRAMES - 1), FALSE);
+            for (j = 0; j < FRAMES - 1; j++) {
+                TEST(Resident(pid, j), TRUE);
+            }
+            break;
+        case P3_POLICY_CLOCKPRO: {
+            int victim = -1;
+            for (j = 0; j <= FRAMES; j++) {
+                Write(j, 'P' + j);
+            }
+            for (j = 0; j < FRAMES; j++) {
+                if (!Resident(pid, j)) {
+                    victim = j;
+                }
+            }
+            TEST(victim != -1, TRUE);
+            int ghostHits = P3_vmStats.ghostHits;
+            Read(victim, 'P' + victim);
+            TEST(P3_vmStats.ghostHits > ghostHits, TRUE);
+            break;
+        }
+        case P3_POLICY_AGING:
+            for (j = 0; j < FRAMES; j++) {
+                Write(j, 'P' + j);
+            }
+            // age OLD while the others stay referenced
+            for (i = 0; i < ITERATIONS; i++) {
+                for (j = 0; j < FRAMES; j++) {
+                    if (j != OLD) {
+                        Read(j, 'P' + j);
+                    }
+                }
+                rc = Sys_Sleep(1);
+                assert(rc == P1_SUCCESS);
+            }
+            for (j = 0; j < FRAMES; j++) {
+                if (j != OLD) {
+                    Read(j, 'P' + j);
+                }
+            }
+            Write(FRAMES, 'P' + FRAMES);
+            TEST(P3_vmStats.agingScans > 0, TRUE);
+            TEST(Resident(pid, OLD), FALSE);
+            break;
+        default:
+            break;
+    }
+    Debug("Probe (%d) done.\n", pid);
+    return 0;
+}
+
+
+int
+P4_Startup(void *arg)
+{
+    int     i;
+    int     rc;
+    int     pid;
+    int     status;
+
+    Debug("P4_Startup starting.\n");
+    rc = P3_VmSetPolicy(-1);
+    TEST(rc, P3_INVALID_POLICY);
+    rc = P3_VmSetPolicy(P3_NUM_POLICIES);
+    TEST(rc, P3_INVALID_POLICY);
+
+    for (policy = 0; policy < P3_NUM_POLICIES; policy++) {
+        Debug("Testing policy %d.\n", policy);
+        rc = P3_VmSetPolicy(policy);
+        TEST(rc, P1_SUCCESS);
+        rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+        TEST(rc, P1_SUCCESS);
+        TEST(P3_vmStats.policy, policy);
+
+        pageSize = USLOSS_MmuPageSize();
+        for (i = 0; i < numChildren; i++) {
+            rc = Sys_Spawn(names[i], Child, (void *) names[i], USLOSS_MIN_STACK * 4, 3, &pid);
+            assert(rc == P1_SUCCESS);
+        }
+        for (i = 0; i < numChildren; i++) {
+            rc = Sys_Wait(&pid, &status);
+            assert(rc == P1_SUCCESS);
+            TEST(status, 0);
+        }
+        Debug("Children terminated\n");
+        TEST(P3_vmStats.replaced > 0, TRUE);
+        TEST(P3_vmStats.pageOuts > 0, TRUE);
+        TEST(P3_vmStats.scanned > 0, TRUE);
+
+        rc = Sys_Spawn("P", Probe, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+        assert(rc == P1_SUCCESS);
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+        Sys_VmShutdown();
+    }
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+    DeleteAllDisks();
+    int rc = Disk_Create(NULL, P3_SWAP_DISK, numChildren * PAGES);
+    assert(rc == 0);
+}
+
+void test_cleanup(int argc, char **argv) {
+    DeleteAllDisks();
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
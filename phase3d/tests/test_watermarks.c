@@ -0,0 +1,194 @@
+/*
+ * test_watermarks.c
+ *
+ *  Reclaimer test case for Phase 3 Part D. It runs the VM system several times:
+ *
+ *      - with the default watermarks, which leave the reclaimer off, so no frames are
+ *        reclaimed.
+ *      - with a high watermark of more than the number of frames, which P3_VmInit
+ *        clamps to one less than the number of frames.
+ *      - with both watermarks set to -1, which selects a quarter and a half of the
+ *        frames.
+ *      - with watermarks of LOW and HIGH.
+ *
+ *  In the first and last runs a process, "A", whose pages don't all fit in memory writes
+ *  its name plus the page number into each of its pages, sleeps for one second, then
+ *  verifies the pages. In the last run, after its sleep the reclaimer must have freed
+ *  frames up to the high watermark, ahead of any fault.
+ *
+ *  It also checks that P3_VmSetWatermarks rejects watermarks that make no sense.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <libdisk.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 8         // # of pages per process
+#define FRAMES 6        // not all of the pages fit
+#define LOW 3           // reclaim when fewer than LOW frames are free...
+#define HIGH 4          // ...until HIGH frames are
+#define PAGERS 2        // # of pagers
+
+static char *vmRegion;
+static char *names[] = {"A"};
+static int  numChildren = sizeof(names) / sizeof(char *);
+static int  pageSize;
+static int  reclaiming; // the reclaimer is on
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+static int debugging = 1;
+#else
+static int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+
+static int
+Child(void *arg)
+{
+    volatile char *name = (char *) arg;
+    int     j;
+    char    *page;
+    int     rc;
+    int     pid;
+
+    Sys_GetPID(&pid);
+    Debug("Child \"%s\" (%d) starting.\n", name, pid);
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child \"%s\" (%d) writing to page %d @ %p\n", name, pid, j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = *name + j;
+        }
+    }
+    rc = Sys_Sleep(1);
+    assert(rc == P1_SUCCESS);
+    if (reclaiming) {
+        // nothing has faulted since the reclaimer was last woken
+        TEST(P3_vmStats.freeFrames >= HIGH, TRUE);
+    } else {
+        TEST(P3_vmStats.freeFrames, 0);
+    }
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child \"%s\" (%d) reading from page %d @ %p\n", name, pid, j, page);
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], *name + j);
+        }
+    }
+    Debug("Child \"%s\" (%d) done.\n", name, pid);
+    return 0;
+}
+
+static void
+Run(void)
+{
+    int     i;
+    int     rc;
+    int     pid;
+    int     status;
+
+    for (i = 0; i < numChildren; i++) {
+        rc = Sys_Spawn(names[i], Child, (void *) names[i], USLOSS_MIN_STACK * 4, 3, &pid);
+        assert(rc == P1_SUCCESS);
+    }
+    for (i = 0; i < numChildren; i++) {
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+    }
+    Debug("Children terminated\n");
+}
+
+
+int
+P4_Startup(void *arg)
+{
+    int     rc;
+    int     low, high;
+
+    Debug("P4_Startup starting.\n");
+    rc = P3_VmSetWatermarks(HIGH, LOW);
+    TEST(rc, P3_INVALID_ARGUMENT);
+    rc = P3_VmSetWatermarks(-2, HIGH);
+    TEST(rc, P3_INVALID_ARGUMENT);
+
+    // the reclaimer is off by default
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    pageSize = USLOSS_MmuPageSize();
+    rc = P3WatermarksGet(&low, &high);
+    TEST(rc, P1_SUCCESS);
+    TEST(low, 0);
+    reclaiming = FALSE;
+    Run();
+    TEST(P3_vmStats.reclaimed, 0);
+    Sys_VmShutdown();
+
+    // a high watermark of FRAMES or more is clamped
+    rc = P3_VmSetWatermarks(LOW, FRAMES + 2);
+    TEST(rc, P1_SUCCESS);
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    rc = P3WatermarksGet(&low, &high);
+    TEST(rc, P1_SUCCESS);
+    TEST(low, LOW);
+    TEST(high, FRAMES - 1);
+    Sys_VmShutdown();
+
+    rc = P3_VmSetWatermarks(-1, -1);
+    TEST(rc, P1_SUCCESS);
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    rc = P3WatermarksGet(&low, &high);
+    TEST(rc, P1_SUCCESS);
+    TEST(low, FRAMES / 4);
+    TEST(high, FRAMES / 2);
+    Sys_VmShutdown();
+
+    rc = P3_VmSetWatermarks(LOW, HIGH);
+    TEST(rc, P1_SUCCESS);
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    reclaiming = TRUE;
+    Run();
+    TEST(P3_vmStats.reclaimed > 0, TRUE);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+    DeleteAllDisks();
+    int rc = Disk_Create(NULL, P3_SWAP_DISK, numChildren * PAGES);
+    assert(rc == 0);
+}
+
+void test_cleanup(int argc, char **argv) {
+    DeleteAllDisks();
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}